@@ -10,6 +10,37 @@
  *	
  *	DATE			CONTENT
  *
+ *	Oct. 16th		1) The index lock is only held by the transactions;
+ *					   with _OLC_VERSION_ the operations out of a transaction
+ *					   run on the node versions of the trie (see burst_trie.c)
+ *					   and only step aside for the transactions.
+ *					2) Enter the epoch of the trie around the operations
+ *					   out of a transaction, retire the deleted records.
+ *					3) A lock manager with a wait-for graph replaces the
+ *					   time-out locks: a deadlock aborts the youngest
+ *					   transaction on the cycle at once; a read lock is
+ *					   upgraded in place.
+ *					4) Update (U) lock mode: a handle whose last transaction
+ *					   read then wrote reads in U mode, which lets the
+ *					   readers in but no other writer, and upgrades to X
+ *					   without a deadlock. It is only a hint from the last
+ *					   transaction of the handle (see btimpl.h).
+ *					5) The catalog is a hash table, openIndex() looks it
+ *					   up without DBLINK_LOCK.
+ *					6) closeIndex() keeps the handle in a per-thread cache,
+ *					   the next openIndex() of the index reuses it.
+ *					7) indexStats() reports the memory of an index
+ *					   (see btimpl.h).
+ *					8) bulkLoad() sorts the records and builds the trie
+ *					   under the write lock at once.
+ *					9) parallelBulkLoad(), bulkLoad() with threads.
+ *					10) A record holds its payload (see burst_trie.h), an
+ *					   insert is logged by the payload it stored.
+ *					11) sharePayloads(); abortTransaction() puts back the
+ *					   last of the deleted records too, and frees them all
+ *					   with freeRecordLink().
+ *					12) compactIndex(), in slices of COMPACT_SLICE containers.
+ *
  * 	Mar. 26th		1) Using new get/getNext method.
  * 					2) Using Time-out lock method to detect dead lock;
  * 					3) Replace the mutex lock to read-write lock; 
@@ -25,16 +56,23 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #include "burst_trie.h"
+#include "btimpl.h"
 
 #define IN_TXN_READ		1
 #define IN_TXN_WRITE	2
 #define IN_TXN_RW		3
 #define	NO_GET			4
 #define	DEAD_LOCK		8
+#define	UPGRADED		16	//the read lock was upgraded in this txn
+#define	WRITE_HINT		32	//so take the U lock to read next time
 
-const long time_limit = 80000000;
+#define	CATALOG_SIZE	1024	//buckets of the catalog, a power of 2
+#define	HANDLE_CACHE_SIZE	64	//closed handles kept by a thread, a power of 2
+#define	COMPACT_SLICE	256		//containers compacted under one write lock
 
 pthread_mutex_t DBLINK_LOCK = PTHREAD_MUTEX_INITIALIZER;
 
@@ -46,14 +84,75 @@ typedef enum {
 
 typedef struct OpLink {
 		OpType type;
-		TrieRecord *rec;
+		TrieRecord *rec;		//the records deleted
+		char *payload;			//the payload inserted, as the trie holds it
 		Key	 key;
 		struct OpLink *next;
 } OpLink;
 
+/**
+ * The lock manager.
+ * A transaction holds the lock of an index until it commits or aborts;
+ * while it waits for a lock, the lock is recorded in its TXNState, so
+ * the wait-for graph is: a waiting txn -> the holders blocking it.
+ * Before a transaction waits, the graph is searched for a cycle through
+ * it, the youngest transaction on the cycle is the victim and gets
+ * DEADLOCK at once; nobody else is aborted, and nobody times out.
+ * The operations out of a transaction hold a lock without any txn, they
+ * never wait while holding it, so they are never on a cycle.
+ * All the lock states are guarded by LOCK_MANAGER.
+ */
+pthread_mutex_t LOCK_MANAGER = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned long txnCounter = 0;
+
+struct TXNState;
+
+/**
+ * S is shared; U is shared with S only, the holder may upgrade to X
+ * waiting just for the S holders to leave; X is exclusive.
+ */
+typedef enum {
+		LOCK_S,
+		LOCK_U,
+		LOCK_X
+} LockMode;
+
+const int lockCompat[3][3] = {
+		/*S  U  X*/
+		{1, 1, 0},	/*S*/
+		{1, 0, 0},	/*U*/
+		{0, 0, 0}	/*X*/
+};
+
+typedef struct LockHolder {
+		struct TXNState *txn;
+		LockMode mode;
+		struct LockHolder *next;
+} LockHolder;
+
+/**
+ * The lock of an index.
+ * In the OLC version the writers out of a transaction do not lock it:
+ * they count themselves in writers and fall back to the lock if any
+ * transaction is in (txns), a transaction waits for the writers in the
+ * trie to leave. The readers out of a transaction take nothing, wseq is
+ * odd while a transaction holds the write lock, they retry if it changed.
+ */
+typedef struct IdxLock {
+		LockHolder *holders;
+		pthread_cond_t cond;
+		int waiters;
+		int txns;
+		int writers;
+		unsigned int wseq;
+} IdxLock;
+
 typedef struct {
 		BurstTrie *dbp;
-		pthread_rwlock_t *lock;
+		IdxLock *lock;
+		LockHolder holder;
+		struct DBLink *db;
 		int txnInfo;
 		Key lastKey;
 		TrieCursor cursor;
@@ -67,34 +166,226 @@ typedef struct TxnLink {
  
 typedef struct TXNState {
 		TxnLink *txnLink;
+		unsigned long id;		//the age, younger is greater
+		IdxLock *waiting;		//the lock waiting for
+		LockMode mode;
+		int victim;
+		unsigned long visit;	//stamp of the cycle search
 } TXNState;
 
+/**
+ * The catalog of the indices, a hash table chained by DBLink.
+ * An index is never dropped, so a DBLink once published stays valid:
+ * openIndex() reads the buckets without any lock, create() serializes
+ * on DBLINK_LOCK and publishes the new link at the head of its bucket.
+ */
 typedef struct DBLink {
         char *name;
+        unsigned int hash;
         BurstTrie *dbp;
-        pthread_rwlock_t lock;
+        IdxLock lock;
         struct DBLink *link;
 } DBLink;
 
-DBLink *dbLookup = NULL;
+DBLink *catalog[CATALOG_SIZE];
 
-ErrCode readLockDB(IDXState *idxState, TXNState *txnState)
+/**
+ * FNV-1a hash of the index name.
+ **/
+static unsigned int hashName(const char *name)
 {
-	/*can not get the lock, return an error.*/
-	struct timespec timeout = {0, 0};
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	
-	timeout.tv_sec = now.tv_sec;
-	timeout.tv_nsec = now.tv_usec*1000 + time_limit;
-	if (timeout.tv_nsec > 1000000000) {
-		timeout.tv_sec ++;
-		timeout.tv_nsec -= 1000000000;
+	unsigned int hash = 2166136261u;
+
+	while (*name != '\0') {
+		hash ^= (unsigned char)(*name ++);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static DBLink *lookupDB(const char *name, unsigned int hash)
+{
+	DBLink *link = __atomic_load_n(&(catalog[hash & (CATALOG_SIZE - 1)]), __ATOMIC_ACQUIRE);
+
+	while (link != NULL && (link->hash != hash || strcmp(name, link->name) != 0))
+		link = link->link;
+
+	return link;
+}
+
+typedef struct HandleCache {
+		DBLink *link;
+		IDXState *state;
+} HandleCache;
+
+__thread HandleCache handleCache[HANDLE_CACHE_SIZE];
+
+pthread_key_t handleKey;
+pthread_once_t handleOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Can the holder (not in the lock yet, or upgrading) take the lock?
+ **/
+static int canGrant(IdxLock *lock, LockHolder *holder, LockMode mode)
+{
+	LockHolder *h;
+
+	for (h = lock->holders; h != NULL; h = h->next) {
+		if (h != holder && !lockCompat[h->mode][mode])
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Search the wait-for graph from txn for the target,
+ * keep the youngest transaction on the path in victim.
+ **/
+static int waitsFor(TXNState *txn, TXNState *target, unsigned long stamp, TXNState **victim)
+{
+	IdxLock *lock = txn->waiting;
+	LockHolder *h;
+
+	if (lock == NULL || txn->visit == stamp)
+		return 0;
+	txn->visit = stamp;
+
+	for (h = lock->holders; h != NULL; h = h->next) {
+		if (h->txn == NULL || h->txn == txn || lockCompat[h->mode][txn->mode])
+			continue;
+		if (h->txn == target || waitsFor(h->txn, target, stamp, victim)) {
+			if (txn->id > (*victim)->id)
+				*victim = txn;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * A transaction has got the lock of the index.
+ **/
+static void txnLocked(IdxLock *lock, LockMode mode, int upgrade)
+{
+#ifdef _OLC_VERSION_
+	if (!upgrade) {
+		__atomic_fetch_add(&(lock->txns), 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&(lock->writers), __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+	}
+	if (mode == LOCK_X)
+		__atomic_fetch_add(&(lock->wseq), 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+ * Take the lock for the holder, also upgrade a S/U lock it holds to X.
+ * The holder of a transaction is its IDXState's, out of a transaction
+ * holder->txn is NULL.
+ * Return DEADLOCK if the transaction is chosen as the victim.
+ **/
+ErrCode lockIndex(IdxLock *lock, LockHolder *holder, LockMode mode)
+{
+	TXNState *txn = holder->txn, *victim;
+	LockHolder *h;
+	int upgrade = 0;
+
+	pthread_mutex_lock(&LOCK_MANAGER);
+
+	for (h = lock->holders; h != NULL; h = h->next) {
+		if (h == holder)
+			upgrade = 1;
+	}
+
+	while (!canGrant(lock, holder, mode)) {
+		if (txn != NULL) {
+			txn->waiting = lock;
+			txn->mode = mode;
+
+			victim = txn;
+			if (waitsFor(txn, txn, __atomic_add_fetch(&txnCounter, 1, __ATOMIC_RELAXED), &victim)) {
+				if (victim == txn) {
+					txn->waiting = NULL;
+					pthread_mutex_unlock(&LOCK_MANAGER);
+					return DEADLOCK;
+				}
+				victim->victim = 1;
+				pthread_cond_broadcast(&(victim->waiting->cond));
+			}
+		}
+
+		lock->waiters ++;
+		pthread_cond_wait(&(lock->cond), &LOCK_MANAGER);
+		lock->waiters --;
+
+		if (txn != NULL && txn->victim) {
+			txn->victim = 0;
+			txn->waiting = NULL;
+			pthread_mutex_unlock(&LOCK_MANAGER);
+			return DEADLOCK;
+		}
+	}
+
+	if (txn != NULL)
+		txn->waiting = NULL;
+
+	holder->mode = mode;
+	if (!upgrade) {
+		holder->next = lock->holders;
+		lock->holders = holder;
+	}
+
+	pthread_mutex_unlock(&LOCK_MANAGER);
+
+	if (txn != NULL)
+		txnLocked(lock, mode, upgrade);
+
+	return SUCCESS;
+}
+
+/**
+ * Release the lock taken by the holder.
+ **/
+void unlockIndex(IdxLock *lock, LockHolder *holder)
+{
+	LockHolder **pre;
+
+#ifdef _OLC_VERSION_
+	if (holder->txn != NULL) {
+		if (holder->mode == LOCK_X)
+			__atomic_fetch_add(&(lock->wseq), 1, __ATOMIC_SEQ_CST);
+		__atomic_fetch_sub(&(lock->txns), 1, __ATOMIC_SEQ_CST);
+	}
+#endif
+
+	pthread_mutex_lock(&LOCK_MANAGER);
+
+	for (pre = &(lock->holders); *pre != NULL; pre = &((*pre)->next)) {
+		if (*pre == holder) {
+			*pre = holder->next;
+			break;
+		}
 	}
+	holder->next = NULL;
+	holder->mode = LOCK_S;
+
+	if (lock->waiters > 0)
+		pthread_cond_broadcast(&(lock->cond));
+	pthread_mutex_unlock(&LOCK_MANAGER);
+}
+
+/**
+ * A read cannot tell whether its transaction writes later, server.h has
+ * no read for update; so U is taken on the hint of the handle's last
+ * transaction only, the first read-then-write of a handle still takes S
+ * and may deadlock on the upgrade.
+ **/
+ErrCode readLockDB(IDXState *idxState, TXNState *txnState)
+{
+	LockMode mode = ((idxState->txnInfo & WRITE_HINT) != 0 ? LOCK_U : LOCK_S);
 
-//	timeout.tv_sec = now.tv_sec + 1;
-//	timeout.tv_nsec = now.tv_usec*1000;
-	if (pthread_rwlock_timedrdlock(idxState->lock, &timeout) != 0)
+	idxState->holder.txn = txnState;
+	if (lockIndex(idxState->lock, &(idxState->holder), mode) != SUCCESS)
 		return DEADLOCK;
 	
 	/*get the lock now!*/
@@ -113,29 +404,14 @@ ErrCode readLockDB(IDXState *idxState, TXNState *txnState)
 ErrCode writeLockDB(IDXState *idxState, TXNState *txnState) 
 {
 	if ((idxState->txnInfo & IN_TXN_READ) != 0) {
-		//Already got the read lock,
-		//realse it and try to get the write lock.
-		pthread_rwlock_unlock(idxState->lock);
-
-		if (pthread_rwlock_trywrlock(idxState->lock) != 0)
+		//Already got the read lock, upgrade it.
+		idxState->txnInfo |= UPGRADED;
+		if (lockIndex(idxState->lock, &(idxState->holder), LOCK_X) != SUCCESS)
 			return DEADLOCK;
 	}
 	else {
-		struct timespec timeout = {0, 0};
-		struct timeval now;
-		gettimeofday(&now, NULL);
-
-		timeout.tv_sec = now.tv_sec;
-		timeout.tv_nsec = now.tv_usec*1000 + time_limit;
-		if (timeout.tv_nsec > 1000000000) {
-			timeout.tv_sec ++;
-			timeout.tv_nsec -= 1000000000;
-		}
-
-		//timeout.tv_sec = now.tv_sec + 1;
-		//timeout.tv_nsec = now.tv_usec*1000;
-
-		if (pthread_rwlock_timedwrlock(idxState->lock, &timeout) != 0)
+		idxState->holder.txn = txnState;
+		if (lockIndex(idxState->lock, &(idxState->holder), LOCK_X) != SUCCESS)
 			return DEADLOCK;
 	
 		idxState->txnInfo |= NO_GET;
@@ -156,23 +432,15 @@ ErrCode writeLockDB(IDXState *idxState, TXNState *txnState)
 ErrCode create(KeyType type, char *name)
 {
     BurstTrie *dbp = NULL;
+    unsigned int hash = hashName(name);
     int ret;
-    //lock the dblink system
+    //lock the dblink system, only create() changes the catalog.
     if ((ret = pthread_mutex_lock(&DBLINK_LOCK)) != 0) {
         printf("can't acquire mutex lock: %d\n", ret);
     }
     
     //make sure that the name specified is not already in use
-    DBLink *link = dbLookup;
-    while (link != NULL) {
-        if (strcmp(name, link->name) == 0) 
-            break;
-		else 
-            link = link->link;
-        
-    }
-    
-    if (link != NULL) {
+    if (lookupDB(name, hash) != NULL) {
         pthread_mutex_unlock(&DBLINK_LOCK);
         return DB_EXISTS;
     }
@@ -187,24 +455,16 @@ ErrCode create(KeyType type, char *name)
     DBLink *newLink = (DBLink*)malloc(sizeof(DBLink));
     memset(newLink, 0, sizeof(DBLink));
     
-    //populate it
-	newLink->name = name;
+    //populate it, keep a copy of the name.
+	newLink->name = strdup(name);
+	newLink->hash = hash;
     newLink->dbp = dbp;
-    newLink->link = NULL;
-    pthread_rwlock_init(&(newLink->lock), NULL);
+    pthread_cond_init(&(newLink->lock.cond), NULL);
     
-	//insert it into the linked list headed by dbLookup
-    if (dbLookup == NULL) {
-        dbLookup = newLink;
-    }
-	else {
-        DBLink *thisLink = dbLookup;
-
-        while (thisLink->link != NULL) {
-            thisLink = thisLink->link;
-        }
-        thisLink->link = newLink;
-    }
+	//publish it at the head of its bucket.
+	DBLink **bucket = &(catalog[hash & (CATALOG_SIZE - 1)]);
+	newLink->link = *bucket;
+	__atomic_store_n(bucket, newLink, __ATOMIC_RELEASE);
     
     //unlock the dblink system, because we're done editing it
     pthread_mutex_unlock(&DBLINK_LOCK);
@@ -212,41 +472,63 @@ ErrCode create(KeyType type, char *name)
     return SUCCESS;
 }
 
+/**
+ * The closed handles of a thread, one per slot, to be reused by the next
+ * openIndex() of the same index; the thread frees them when exits.
+ **/
+static void releaseHandles(void *arg)
+{
+	HandleCache *cache = (HandleCache*)arg;
+	int i;
+
+	for (i=0; i<HANDLE_CACHE_SIZE; i++) {
+		free(cache[i].state);
+		cache[i].state = NULL;
+	}
+}
+
+static void initHandleKey(void)
+{
+	pthread_key_create(&handleKey, releaseHandles);
+}
+
 ErrCode openIndex(const char *name, IdxState **idxState)
 {
-    //lock the dblink system
-    if (pthread_mutex_lock(&DBLINK_LOCK) != 0) {
-        fprintf(stderr, "can't acquire mutex lock!\n");
-    }
-    
-    //look up the DBLink for the index of that name
-    DBLink *link = dbLookup;
-    while (link != NULL) {
-        if (strcmp(name, link->name) == 0) 
-            break;
-        else 
-            link = link->link;
-        
+    unsigned int hash = hashName(name);
+    HandleCache *cache = &(handleCache[hash & (HANDLE_CACHE_SIZE - 1)]);
+    IDXState *state = cache->state;
+
+    //reuse the handle closed by this thread.
+    if (state != NULL && cache->link->hash == hash && strcmp(name, cache->link->name) == 0) {
+        cache->state = NULL;
+        //keep the write hint of the last transaction.
+        state->txnInfo &= WRITE_HINT;
+        memset(&(state->lastKey), 0, sizeof(Key));
+        memset(&(state->cursor), 0, sizeof(TrieCursor));
+
+        *idxState = (IdxState*)state;
+        return SUCCESS;
     }
+
+    //look up the DBLink for the index of that name, no lock.
+    DBLink *link = lookupDB(name, hash);
     
     //if no link was found, index was never create()d
     if (link == NULL) {
-        pthread_mutex_unlock(&DBLINK_LOCK);
         return DB_DNE;
     }
     
     
     //create a IDXState variable for this thread
-    IDXState *state = malloc(sizeof(IDXState));
+    state = malloc(sizeof(IDXState));
     memset(state, 0, sizeof(IDXState));
     state->dbp = link->dbp;
     state->lock = &(link->lock);
+    state->db = link;
     memset(&(state->cursor), 0, sizeof(TrieCursor));
     state->txnInfo = 0;
     
     *idxState = (IdxState*)state;
-    //unlock the dblink system
-    pthread_mutex_unlock(&DBLINK_LOCK);
     
     return SUCCESS;
 }
@@ -254,9 +536,133 @@ ErrCode openIndex(const char *name, IdxState **idxState)
 ErrCode closeIndex(IdxState *ident)
 {
 	IDXState *state = (IDXState*)ident;
-    free(state);
+	HandleCache *cache = &(handleCache[state->db->hash & (HANDLE_CACHE_SIZE - 1)]);
+
+	//a handle still in a transaction is not reused.
+	if ((state->txnInfo & IN_TXN_RW) != 0 || state->opLink != NULL) {
+		free(state);
+		return SUCCESS;
+	}
+
+	pthread_once(&handleOnce, initHandleKey);
+	if (pthread_getspecific(handleKey) == NULL)
+		pthread_setspecific(handleKey, handleCache);
+
+	free(cache->state);
+	cache->link = state->db;
+	cache->state = state;
+
+    return SUCCESS;
+}
+
+/**
+ * Walk the index under a read lock, taken as a transaction of its own
+ * so that the writers out of a transaction leave the trie as well.
+ **/
+ErrCode indexStats(const char *name, IndexStats *stats)
+{
+	DBLink *link = lookupDB(name, hashName(name));
+	TXNState txn;
+	LockHolder holder = {&txn, LOCK_S, NULL};
+	TrieStats trieStats;
+	ErrCode ret = SUCCESS;
+
+	if (link == NULL)
+		return DB_DNE;
+
+	memset(&txn, 0, sizeof(TXNState));
+	txn.id = __atomic_add_fetch(&txnCounter, 1, __ATOMIC_RELAXED);
+
+	//it holds no other lock, so it is never on a cycle.
+	if (lockIndex(&(link->lock), &holder, LOCK_S) != SUCCESS)
+		return FAILURE;
+
+	if (getTrieStats(link->dbp, &trieStats) == BT_SUCCESS) {
+		stats->keys = trieStats.keys;
+		stats->records = trieStats.records;
+		stats->reserved = trieStats.reserved;
+		stats->used = trieStats.used;
+		stats->objects = trieStats.objects;
+		stats->bytes_per_key = trieStats.bytes_per_key;
+		stats->payloads = trieStats.payloads;
+		stats->payload_refs = trieStats.payload_refs;
+	}
+	else {
+		ret = FAILURE;
+	}
+
+	unlockIndex(&(link->lock), &holder);
+
+	return ret;
+}
 
-    return SUCCESS;    
+/**
+ * Share the payloads of the empty index name (see sharePayloadsBurstTrie),
+ * under the write lock taken as a transaction of its own.
+ **/
+ErrCode sharePayloads(const char *name)
+{
+	DBLink *link = lookupDB(name, hashName(name));
+	TXNState txn;
+	LockHolder holder = {&txn, LOCK_X, NULL};
+	ErrCode ret = SUCCESS;
+
+	if (link == NULL)
+		return DB_DNE;
+
+	memset(&txn, 0, sizeof(TXNState));
+	txn.id = __atomic_add_fetch(&txnCounter, 1, __ATOMIC_RELAXED);
+
+	if (lockIndex(&(link->lock), &holder, LOCK_X) != SUCCESS)
+		return FAILURE;
+
+	if (sharePayloadsBurstTrie(link->dbp) != BT_SUCCESS)
+		ret = FAILURE;
+
+	unlockIndex(&(link->lock), &holder);
+
+	return ret;
+}
+
+/**
+ * Trim the containers of the index name to their sizes (see compactBurstTrie),
+ * COMPACT_SLICE of them at a time under the write lock taken as a transaction
+ * of its own; the lock is let go between the slices. The old containers go
+ * back to the slab of the index, which gives its emptied blocks back.
+ **/
+ErrCode compactIndex(const char *name)
+{
+	DBLink *link = lookupDB(name, hashName(name));
+	TXNState txn;
+	LockHolder holder = {&txn, LOCK_X, NULL};
+	EpochThread *epoch = NULL;
+	BurstTrieErrCode ret = BT_SUCCESS;
+	Key key;
+	int resume = 0;
+
+	if (link == NULL)
+		return DB_DNE;
+
+	memset(&txn, 0, sizeof(TXNState));
+	txn.id = __atomic_add_fetch(&txnCounter, 1, __ATOMIC_RELAXED);
+
+	while (ret == BT_SUCCESS) {
+		if (lockIndex(&(link->lock), &holder, LOCK_X) != SUCCESS)
+			return FAILURE;
+
+		epoch = epochEnter(&(link->dbp->epoch));
+		ret = compactBurstTrie(link->dbp, &key, resume, COMPACT_SLICE);
+		epochExit(epoch);
+
+		unlockIndex(&(link->lock), &holder);
+		//free the old containers of the slices as soon as the readers allow.
+		epochReclaim(&(link->dbp->epoch), epoch);
+		resume = 1;
+		sched_yield();
+	}
+	epochReclaim(&(link->dbp->epoch), epoch);
+
+	return ((ret == BT_END) ? SUCCESS : FAILURE);
 }
 
 
@@ -264,7 +670,9 @@ ErrCode closeIndex(IdxState *ident)
 ErrCode beginTransaction(TxnState **txn) 
 {	
 	TXNState *state = (TXNState*)malloc(sizeof(TXNState));
+	memset(state, 0, sizeof(TXNState));
 	state->txnLink = NULL;
+	state->id = __atomic_add_fetch(&txnCounter, 1, __ATOMIC_RELAXED);
 	
 	*txn = (TxnState*)state;
 
@@ -285,30 +693,33 @@ ErrCode abortTransaction(TxnState *txn)
 	
 	while (txnLink != NULL) {
 		IDXState *idxState = txnLink->idx;
-		OpLink *tLink, *link = idxState->opLink;
+		BurstTrie *dbp = idxState->dbp;
+		OpLink *tLink, *link = idxState->opLink, *dead = NULL;
 		
 		while (link) {
 			tLink = link;
 			link = link->next;
 			
-			BurstTrie *dbp = idxState->dbp;
 			TrieRecord *del = NULL, *rec = tLink->rec;
+			char *str;
 		//Role back!	
 			switch (tLink->type) {				
 				case INSERT:
-					if (deleteBurstTrie(dbp, &(tLink->key), rec->payload, &del) != BT_SUCCESS) 
+					if (deleteBurstTrie(dbp, &(tLink->key), tLink->payload, &del) != BT_SUCCESS) 
 						goto abortErr; 
-					free(rec);
-					freeRecordLink(del);
+					freeRecordLink(dbp, del);
 					break;
 				case DELETE:	
-					while (rec->next != NULL) {
-						if (insertBurstTrie(dbp, &(tLink->key), &(rec->payload)) != BT_SUCCESS) 
+					//put back all the deleted records, the last one too.
+					for (; rec != NULL; rec = rec->next) {
+						str = (char*)recordPayload(dbp, rec);
+						if (insertBurstTrie(dbp, &(tLink->key), &str) != BT_SUCCESS) 
 							goto abortErr; 
-						TrieRecord *tmpRec = rec;
-						rec = rec->next;
-						free(tmpRec);
 					}
+					//an older insert may be logged by one of their payloads.
+					tLink->next = dead;
+					dead = tLink;
+					continue;
 
 				default:	break;
 			}
@@ -316,10 +727,18 @@ ErrCode abortTransaction(TxnState *txn)
 			free(tLink);
 		}
 
-		if ((idxState->txnInfo & DEAD_LOCK) == 0) 
-			pthread_rwlock_unlock(idxState->lock);
+		//drop the deleted records, and their shared payloads.
+		while (dead) {
+			tLink = dead;
+			dead = dead->next;
+			freeRecordLink(dbp, tLink->rec);
+			free(tLink);
+		}
+
+		//also holds the read lock if the upgrade failed.
+		unlockIndex(idxState->lock, &(idxState->holder));
 		
-		idxState->txnInfo = 0;
+		idxState->txnInfo = ((idxState->txnInfo & UPGRADED) != 0 ? WRITE_HINT : 0);
 		idxState->opLink = NULL;
 		tmp = txnLink;
 		txnLink = txnLink->next;
@@ -355,22 +774,16 @@ ErrCode commitTransaction(TxnState *txn)
 		while (link) {
 			tLink = link;
 			link = link->next;
-			if (tLink->rec) {
-				switch (tLink->type) {
-					case DELETE:
-						freeRecordLink(tLink->rec);break;
-					case INSERT:
-						free(tLink->rec);break;
-				}
-			}
+			if (tLink->type == DELETE && tLink->rec)
+				freeRecordLink(idxState->dbp, tLink->rec);
 			free(tLink);
 		}
 
-		idxState->txnInfo = 0;
+		idxState->txnInfo = ((idxState->txnInfo & UPGRADED) != 0 ? WRITE_HINT : 0);
 		idxState->opLink = NULL;
 		memset(&(idxState->lastKey), 0, sizeof(Key));
 		
-		pthread_rwlock_unlock(idxState->lock);
+		unlockIndex(idxState->lock, &(idxState->holder));
 		
 		tmp = txnLink;
 		txnLink = txnLink->next;
@@ -413,7 +826,7 @@ ErrCode get(IdxState *ident, TxnState *txn, Record *record)
 			}
 			else {
 				idxState->txnInfo &= (~NO_GET);
-				strcpy(record->payload, cursor->record->payload);
+				strcpy(record->payload, recordPayload(dbp, cursor->record));
 				cursor->record = cursor->record->next;
 
 				return SUCCESS;
@@ -425,23 +838,47 @@ ErrCode get(IdxState *ident, TxnState *txn, Record *record)
 		}
 	}
 	else if (txnState == NULL) { //out of a transaction.
-		if (pthread_rwlock_rdlock(idxState->lock) == 0) {
+#ifdef _OLC_VERSION_
+		IdxLock *lock = idxState->lock;
+		while (1) {
+			unsigned int seq = __atomic_load_n(&(lock->wseq), __ATOMIC_ACQUIRE);
+			if ((seq & 1) == 0) {
+				EpochThread *epoch = epochEnter(&(dbp->epoch));
+				if (getRecordOptimistic(dbp, &(record->key), record->payload) != BT_SUCCESS)
+					ret = KEY_NOTFOUND;
+				else
+					ret = SUCCESS;
+				epochExit(epoch);
+
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&(lock->wseq), __ATOMIC_RELAXED) == seq)
+					return ret;
+			}
+			//a transaction is writing, wait for it.
+			LockHolder holder = {NULL, LOCK_S, NULL};
+			lockIndex(lock, &holder, LOCK_S);
+			unlockIndex(lock, &holder);
+		}
+#else
+		LockHolder holder = {NULL, LOCK_S, NULL};
+		if (lockIndex(idxState->lock, &holder, LOCK_S) == SUCCESS) {
 			
 			if (getCursor(dbp, cursor, &(record->key)) != BT_SUCCESS) {
 				ret = KEY_NOTFOUND;
 			}
 			else {
-				strcpy(record->payload, cursor->record->payload);
+				strcpy(record->payload, recordPayload(dbp, cursor->record));
 				ret = SUCCESS;
 			}
 			
-			pthread_rwlock_unlock(idxState->lock);
+			unlockIndex(idxState->lock, &holder);
 			
 			return ret;
 		}
 		else {
 			return FAILURE;
 		}
+#endif
 	}
 	else {
 		perror("send a undefined TxnState pointer!\n");
@@ -471,7 +908,7 @@ ErrCode getNext(IdxState *idxState, TxnState *txn, Record *record)
 			TrieRecord *p = cursor->record;
 			if ((state->txnInfo & NO_GET) == 0 && p != NULL) {
 				memcpy(&(record->key), &(state->lastKey), sizeof(Key));
-				memcpy(record->payload, p->payload, MAX_PAYLOAD_LEN);
+				memcpy(record->payload, recordPayload(dbp, p), recordLen(dbp, p) + 1);
 				cursor->record = cursor->record->next;
 					
 				ret = SUCCESS;
@@ -486,7 +923,7 @@ ErrCode getNext(IdxState *idxState, TxnState *txn, Record *record)
 				}
 				if (getNextCursor(dbp, cursor, &(record->key)) == BT_SUCCESS) {
 					memcpy(&(state->lastKey), &(record->key), sizeof(Key));
-					strcpy(record->payload, cursor->record->payload);
+					strcpy(record->payload, recordPayload(dbp, cursor->record));
 					
 					cursor->record = cursor->record->next;
 					state->txnInfo &= (~NO_GET);
@@ -506,7 +943,30 @@ ErrCode getNext(IdxState *idxState, TxnState *txn, Record *record)
 		}
 	}
 	else if (txnState == NULL) {//out of a transaction.
-		if(pthread_rwlock_rdlock(state->lock) == 0) {
+#ifdef _OLC_VERSION_
+		IdxLock *lock = state->lock;
+		while (1) {
+			unsigned int seq = __atomic_load_n(&(lock->wseq), __ATOMIC_ACQUIRE);
+			if ((seq & 1) == 0) {
+				EpochThread *epoch = epochEnter(&(dbp->epoch));
+				if (getFirstOptimistic(dbp, &(record->key), record->payload) != BT_SUCCESS)
+					ret = KEY_NOTFOUND;
+				else
+					ret = SUCCESS;
+				epochExit(epoch);
+
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&(lock->wseq), __ATOMIC_RELAXED) == seq)
+					return ret;
+			}
+			//a transaction is writing, wait for it.
+			LockHolder holder = {NULL, LOCK_S, NULL};
+			lockIndex(lock, &holder, LOCK_S);
+			unlockIndex(lock, &holder);
+		}
+#else
+		LockHolder holder = {NULL, LOCK_S, NULL};
+		if (lockIndex(state->lock, &holder, LOCK_S) == SUCCESS) {
 			cursor->trie = dbp->root;
 			cursor->pos = -1;
 			cursor->record = NULL;
@@ -515,17 +975,18 @@ ErrCode getNext(IdxState *idxState, TxnState *txn, Record *record)
 				ret = KEY_NOTFOUND;
 			}
 			else {
-				strcpy(record->payload, cursor->record->payload);
+				strcpy(record->payload, recordPayload(dbp, cursor->record));
 				ret = SUCCESS;
 			}
 			
-			pthread_rwlock_unlock(state->lock);
+			unlockIndex(state->lock, &holder);
 			
 			return ret;
 		}
 		else {
 			return FAILURE;
 		}
+#endif
 	}
 	else {
 		perror("send a undefined TxnState pointer!\n");
@@ -563,9 +1024,8 @@ ErrCode insertRecord(IdxState *ident, TxnState *txn, Key *k, const char* payload
 				}
 				//add a new transaction entry.
 				OpLink *op = (OpLink*)malloc(sizeof(OpLink));
-				op->rec = malloc(sizeof(TrieRecord));
-				op->rec->payload = str;
-				op->rec->next = NULL;
+				op->rec = NULL;
+				op->payload = str;
 				op->type = INSERT;
 				memcpy(&(op->key), k, sizeof(Key));
 				op->next = idxState->opLink;
@@ -583,15 +1043,35 @@ ErrCode insertRecord(IdxState *ident, TxnState *txn, Key *k, const char* payload
 		}
 	}
 	else if (txnState == NULL) {
-		if (pthread_rwlock_wrlock(idxState->lock) == 0) {
+#ifdef _OLC_VERSION_
+		IdxLock *lock = idxState->lock;
+		__atomic_fetch_add(&(lock->writers), 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&(lock->txns), __ATOMIC_SEQ_CST) == 0) {
+			EpochThread *epoch = epochEnter(&(dbp->epoch));
+			if (insertBurstTrie(dbp, k, &str) == 0) 
+				ret = SUCCESS;
+			else 
+				ret = ENTRY_EXISTS;
+			epochExit(epoch);
+
+			__atomic_fetch_sub(&(lock->writers), 1, __ATOMIC_SEQ_CST);
+			return ret;
+		}
+		//a transaction is in, queue on the lock.
+		__atomic_fetch_sub(&(lock->writers), 1, __ATOMIC_SEQ_CST);
+#endif
+		LockHolder holder = {NULL, LOCK_X, NULL};
+		if (lockIndex(idxState->lock, &holder, LOCK_X) == SUCCESS) {
+			EpochThread *epoch = epochEnter(&(dbp->epoch));
 			
 			if (insertBurstTrie(dbp, k, &str) == 0) 
 				ret = SUCCESS;
 			
 			else 
 				ret = ENTRY_EXISTS;
+			epochExit(epoch);
 
-			pthread_rwlock_unlock(idxState->lock);
+			unlockIndex(idxState->lock, &holder);
 			
 			return ret;
 		}
@@ -682,6 +1162,7 @@ ErrCode deleteRecord(IdxState *ident, TxnState *txn, Record *theRecord)
 			//add a new transaction entry.
 			OpLink *op = (OpLink*)malloc(sizeof(OpLink));
 			op->rec = del;
+			op->payload = NULL;
 			op->type = DELETE;
 			memcpy(&(op->key), &(theRecord->key), sizeof(Key));
 			op->next = idxState->opLink;
@@ -696,17 +1177,40 @@ ErrCode deleteRecord(IdxState *ident, TxnState *txn, Record *theRecord)
 		}
 	}
 	else if (txnState == NULL) {
-		if (pthread_rwlock_wrlock(idxState->lock) == 0) {
+#ifdef _OLC_VERSION_
+		IdxLock *lock = idxState->lock;
+		__atomic_fetch_add(&(lock->writers), 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&(lock->txns), __ATOMIC_SEQ_CST) == 0) {
+			EpochThread *epoch = epochEnter(&(dbp->epoch));
+			if (deleteBurstTrie(dbp, &(theRecord->key), str, &del) == 0) {
+				freeRecordLink(dbp, del);
+				ret = SUCCESS;
+			}
+			else {
+				ret = KEY_NOTFOUND;
+			}
+			epochExit(epoch);
+
+			__atomic_fetch_sub(&(lock->writers), 1, __ATOMIC_SEQ_CST);
+			return ret;
+		}
+		//a transaction is in, queue on the lock.
+		__atomic_fetch_sub(&(lock->writers), 1, __ATOMIC_SEQ_CST);
+#endif
+		LockHolder holder = {NULL, LOCK_X, NULL};
+		if (lockIndex(idxState->lock, &holder, LOCK_X) == SUCCESS) {
+			EpochThread *epoch = epochEnter(&(dbp->epoch));
 			
 			if (deleteBurstTrie(dbp, &(theRecord->key), str, &del) == 0) {
-				freeRecordLink(del);
+				freeRecordLink(dbp, del);
 				ret = SUCCESS;
 			}
 			else {
 				ret = KEY_NOTFOUND;
 			}
+			epochExit(epoch);
 			
-			pthread_rwlock_unlock(idxState->lock);
+			unlockIndex(idxState->lock, &holder);
 			
 			return ret;
 		}
@@ -720,3 +1224,71 @@ ErrCode deleteRecord(IdxState *ident, TxnState *txn, Record *theRecord)
 	
 	return FAILURE;
 }
+
+
+/**
+ * Load the records with the threads, see bulkLoadBurstTrie().
+ **/
+static ErrCode loadRecords(IdxState *ident, const Record *records, size_t n, int sorted, int threads)
+{
+	IDXState *idxState = (IDXState*)ident;
+	BurstTrie *dbp = idxState->dbp;
+	TrieLoad *items = NULL;
+	TXNState txn;
+	LockHolder holder = {&txn, LOCK_X, NULL};
+	EpochThread *epoch = NULL;
+	ErrCode ret = SUCCESS;
+	size_t i;
+
+	//it would wait for the lock of its own transaction.
+	if ((idxState->txnInfo & IN_TXN_RW) != 0)
+		return FAILURE;
+
+	if (n == 0)
+		return SUCCESS;
+
+	if ((items = (TrieLoad*)malloc(n*sizeof(TrieLoad))) == NULL)
+		return FAILURE;
+
+	for (i=0; i<n; i++) {
+		setKeyVal(&(items[i].keyval), &(records[i].key));
+		items[i].payload = records[i].payload;
+	}
+
+	//sort out of the lock.
+	if (sortTrieLoad(dbp, items, n, sorted, threads) != BT_SUCCESS) {
+		free(items);
+		return FAILURE;
+	}
+
+	memset(&txn, 0, sizeof(TXNState));
+	txn.id = __atomic_add_fetch(&txnCounter, 1, __ATOMIC_RELAXED);
+
+	if (lockIndex(idxState->lock, &holder, LOCK_X) != SUCCESS) {
+		free(items);
+		return FAILURE;
+	}
+
+	epoch = epochEnter(&(dbp->epoch));
+	if (bulkLoadBurstTrie(dbp, items, n, threads) != BT_SUCCESS)
+		ret = FAILURE;
+	epochExit(epoch);
+
+	unlockIndex(idxState->lock, &holder);
+	free(items);
+
+	return ret;
+}
+
+ErrCode bulkLoad(IdxState *ident, const Record *records, size_t n, int sorted)
+{
+	return loadRecords(ident, records, n, sorted, 1);
+}
+
+ErrCode parallelBulkLoad(IdxState *ident, const Record *records, size_t n, int sorted, int threads)
+{
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	return loadRecords(ident, records, n, sorted, threads);
+}
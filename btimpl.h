@@ -0,0 +1,93 @@
+/**
+ *	btimpl.h
+ *	The functions of the index beyond server.h.
+ *
+ *	License:	BSD OPEN SOURCE LICENSE
+ *
+ *	CHANGE LIST:
+ *
+ *	DATE			CONTENT
+ *	Oct. 16th		1) Start, indexStats().
+ *					2) bulkLoad().
+ *					3) parallelBulkLoad().
+ *					4) sharePayloads(), IndexStats counts the shared payloads.
+ *					5) compactIndex().
+ *					6) Note the U lock of the transactions.
+ *
+ */
+
+#ifndef _BTIMPL_H_
+#define _BTIMPL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*server.h has no include guard, include it before this file.*/
+
+/**
+ * A transaction locks each index it touches: S for its reads, X for its
+ * writes, a read lock is upgraded when the transaction writes after it.
+ * A handle whose last transaction did so reads in U mode in its next
+ * one, which lets the readers in but no other writer and upgrades to X
+ * without a deadlock. U is a hint from that last transaction only: a
+ * handle that has not read then written before takes S, and two such
+ * transactions upgrading at once still deadlock, one is aborted.
+ **/
+
+/*the allocation statistics of an index.*/
+typedef struct IndexStats {
+	uint64_t	keys;
+	uint64_t	records;
+	uint64_t	reserved;		//bytes got from the system
+	uint64_t	used;			//bytes of the live nodes, keys and records
+	uint64_t	objects;
+	double		bytes_per_key;	//reserved / keys
+	uint64_t	payloads;		//stored once each, 0 unless sharePayloads()
+	uint64_t	payload_refs;	//records pointing to them
+} IndexStats;
+
+
+//functions list
+
+/**
+ * Fill in the statistics of the index name, as a reader of the whole
+ * index: it waits for the transactions writing it.
+ * Return DB_DNE if there is no such index.
+ **/
+ErrCode indexStats(const char *name, IndexStats *stats);
+
+/**
+ * Load n records into the index at once, out of any transaction.
+ * The records are sorted by key first unless sorted is set (and true);
+ * an empty index is built bottom-up, else they are inserted one by one.
+ * A payload already stored under its key is skipped.
+ * Return FAILURE if the handle is in a transaction.
+ **/
+ErrCode bulkLoad(IdxState *idxState, const Record *records, size_t n, int sorted);
+
+/**
+ * bulkLoad() with up to threads threads (the number of CPUs if <= 0):
+ * the records are partitioned on the first key byte that tells them
+ * apart, the partitions are sorted and built into subtrees in parallel.
+ **/
+ErrCode parallelBulkLoad(IdxState *idxState, const Record *records, size_t n, int sorted, int threads);
+
+/**
+ * Store each payload of the index name once, however many keys it is
+ * under: for a secondary index whose payloads repeat, a record is then a
+ * pointer and the copies are counted. Call it right after create().
+ * Return DB_DNE if there is no such index, FAILURE if it is not empty.
+ **/
+ErrCode sharePayloads(const char *name);
+
+/**
+ * Move each container of the index name into memory of exactly its size,
+ * e.g. after many deletes. The slab gives back to the system the blocks
+ * left with no object in use; the records stay where they are, so a block
+ * still holding one is kept. It runs in short slices under the write lock,
+ * the other operations go on between them.
+ * Return DB_DNE if there is no such index.
+ **/
+ErrCode compactIndex(const char *name);
+
+#endif
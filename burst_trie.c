@@ -9,6 +9,81 @@
  *	CHANGES LIST:
  *
  *	DATE				CONTENT
+ *	Oct. 16th			1) Adaptive trie nodes, see findChild/addChild/removeChild;
+ *						   the burst builds the smallest node kind that fits,
+ *						   deleteBurstTrie shrinks the index again.
+ *						2) Find the next/previous child of NODE48/NODE256 with
+ *						   tzcnt/lzcnt on the occupancy bitmap, and of NODE16
+ *						   with a SSE2 compare.
+ *						3) Optimistic lock coupling: every node carries a
+ *						   version, writers lock only the nodes they change
+ *						   (and the leaf neighbours in the double link),
+ *						   readers validate the versions and restart.
+ *						   The containers are no longer realloc()ed in place.
+ *						4) Nothing reachable by a reader is freed directly,
+ *						   it is retired to the epoch of the trie.
+ *						5) Allocate from the slab of the trie with the caches
+ *						   of the calling thread, getTrieStats() for the
+ *						   memory per key, destroyBurstTrie() for the bulk
+ *						   release.
+ *						6) bulkLoadBurstTrie() builds an empty trie bottom-up
+ *						   from sorted records: the containers, the trie
+ *						   nodes and the leaf link in one pass.
+ *						7) A parallel bulk load: partition the items on the
+ *						   first position that tells them apart, sort and
+ *						   build the partitions on the threads, then link
+ *						   the leaves across them.
+ *						8) Struct-of-arrays containers: the keys, then the
+ *						   records, in one block; a nil node is a container
+ *						   of one key. findKey() narrows a container down to
+ *						   SEARCH_WINDOW keys with a branch-free binary search,
+ *						   and counts the INT/SHORT keys less than the key
+ *						   there with AVX2 or AVX-512, picked once by
+ *						   __builtin_cpu_supports(); SHORT keys are sign
+ *						   extended to compare as int64.
+ *						9) Normalized INT/SHORT keys (setKeyVal): the sign
+ *						   flipped, a SHORT key in the high half. keyCmp is an
+ *						   unsigned compare, which no longer overflows at the
+ *						   ends of the int64 range; getIndex is a byte shift.
+ *						10) getCursor, getNextCursor, getRecordOptimistic,
+ *						   insertBurstTrie and deleteBurstTrie are compiled
+ *						   once per key type (SWITCH_KEY_TYPE).
+ *						11) A VARCHAR leaf at depth keeps the path to it once
+ *						   (Prefix), and each key only from depth on, in a
+ *						   slab object just as long as it; a burst stores the
+ *						   moved keys again one byte shorter.
+ *						12) The head of each VARCHAR key in its container
+ *						   (keyHead): most compares of a search never touch
+ *						   the key string.
+ *						13) Front code the keys of a VARCHAR container into
+ *						   one blob (packKeys), a key is decoded from the
+ *						   restart before it; a change codes a new blob.
+ *						   A VARCHAR trie bursts down to MAX_VARCHAR_LEN,
+ *						   not MAX_PAYLOAD_LEN: no container of long keys
+ *						   outgrows the buffers sized by CH_CONT_SIZE.
+ *						14) A VARCHAR trie node is indexed by the whole byte,
+ *						   not by the byte - 64 which folded '@' onto the
+ *						   nil node and the bytes out of '@'..127 anywhere.
+ *						15) Fold the nil nodes into their parents: the key
+ *						   ending at a trie node is its term, out of the leaf
+ *						   link; getNextCursor() finds it before the children
+ *						   (termBefore). A trie node left with the term only
+ *						   is a container of it again.
+ *						16) sharePayloadsBurstTrie(): the records point to one
+ *						   counted copy of each payload in the PayloadPool,
+ *						   freeRecordLink() drops the references.
+ *						   getTrieStats() counts the payloads and their
+ *						   references.
+ *						17) mergeTrieNode(): a delete folds a trie node with a
+ *						   few keys left below it into one container again,
+ *						   up the path while they fold.
+ *						18) compactBurstTrie(): the containers of the leaf
+ *						   chain moved into keys of exactly their sizes, in
+ *						   slices resumed from a key.
+ *						19) recodeKeys() codes only the front coded block of
+ *						   the changed key again (FRONT_START), the other
+ *						   blocks are copied into the new blob as they are.
+ *
  *	Mar. 28th			1) Add a Re-Size method to control the memory waist:
  *						   When alloc the container space for the i-th depth node,
  *						   just alloc MAX_CONATINER_SIZE / 2^i first;
@@ -29,1118 +104,3814 @@
 
 #include "burst_trie.h"
 
-#define cpyKeyVal(to, from)	(to).intkey = (from).intkey
+#include <sched.h>
 
-inline BurstTrieErrCode reSizeContainer(TrieNode *trie, int container_size, int depth)
-{
-	if (depth == 0 || trie->MaxSize >= container_size)
-		return BT_ERROR;
-	int size = (container_size >> depth);
-	if (size < MIN_CONT)
-		size = MIN_CONT;
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-	size += trie->MaxSize;
-	TrieLeaf *tmp = trie->Cont;
+#if defined(_SIMD_SEARCH_) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
-	if ((trie->Cont = realloc(tmp, sizeof(TrieLeaf)*size)) == NULL) 
-		return BT_ERROR;
-	
-	memset(&(trie->Cont[trie->MaxSize]), 0, sizeof(TrieLeaf)*(size-trie->MaxSize));
-	trie->MaxSize = size;
+#define cpyKeyVal(to, from)	(to).normkey = (from).normkey
 
-	return BT_SUCCESS;
-	
-}
+/*flips the sign of an INT key, and of a SHORT key in the high half.*/
+#define INT_SIGN	(1ULL << 63)
 
-void inline setKeyVal(KeyVal *keyval, Key *key)
-{
-	switch (key->type) {
-		case SHORT:
-		case INT:	keyval->intkey = key->keyval.intkey; return;
-		case VARCHAR:	keyval->charkey = &(key->keyval.charkey[0]); return;
+/**
+ * The hot operations are written once with the key type as an argument
+ * and always inlined into a switch on the type of the trie: every case
+ * is compiled with a constant type, getIndex, keyCmp and findKey fold
+ * to the code of that type, and the trie dispatches once per call.
+ */
+#define KEY_TYPE_INLINE	static inline __attribute__((always_inline))
+
+#define SWITCH_KEY_TYPE(bt, call)	\
+	switch ((bt)->type) {	\
+		case SHORT:		{ const KeyType type = SHORT; return call; }	\
+		case INT:		{ const KeyType type = INT; return call; }	\
+		default:		{ const KeyType type = VARCHAR; return call; }	\
 	}
-}
+
 /**
- * Use to get the position in the trie in-node index.
+ * All the memory of a trie comes from its slab, through the slab caches
+ * of the calling thread, which live in its epoch record.
  */
-uint8_t inline getIndex(int depth, KeyVal keyval, KeyType type)
+static inline SlabCache *trieCaches(BurstTrie *bt)
 {
-	uint8_t pos;
-	int tmp;
-	
-	switch (type) {
-		case SHORT:
-			tmp = (int8_t)keyval.units[3-depth];
-	
-			if (depth == 0) {
-				tmp += INT_TREE_WIDTH/2;
-			}
-			return (uint8_t)tmp;
-			
-		case INT:
-		
-			tmp = (int8_t)keyval.units[7-depth];
-			
-			if (depth == 0) {
-				tmp += INT_TREE_WIDTH/2;
-			}
-			return (uint8_t)tmp;
-			
-		case VARCHAR:
-			pos = (uint8_t)(keyval.charkey[depth]);
-			if (pos != 0) {
-				pos -= 64;
-			}
-			return pos;
-	} 
+	EpochThread *thread = epochThread(&(bt->epoch));
 
-	return pos;
-}
+	if (thread->cache == NULL)
+		thread->cache = newSlabCaches();
 
+	return (SlabCache*)thread->cache;
+}
 
-/**
- * Compare two KeyVal type elements key1 and key2.
- * if key1 > key2 return a postive number;
- * else if key1 < key2 return a negtive one;
- * else 0 should be returned.
- **/
-void inline keyCmp(KeyVal key1, KeyVal key2, int depth, KeyType type, int64_t *cmp) 
+void *trieAlloc(BurstTrie *bt, size_t size)
 {
-	switch (type) {
-		case SHORT:
-			*cmp = key1.shortkey - key2.shortkey;
-			break;
-		case INT:
-			*cmp = key1.intkey - key2.intkey;
-			break;
-		case VARCHAR:
-			*cmp = strcmp(key1.charkey+depth, key2.charkey+depth);
-			break;
-		//default :
-			
-	}
-	
+	return slabAlloc(&(bt->slab), trieCaches(bt), size);
 }
 
-/**
- * release the memory space of the deleted record link.
- */
-BurstTrieErrCode freeRecordLink(TrieRecord *record) 
+/*the epoch gives the retired memory back to the slab.*/
+static void trieRelease(void *arg, void *cache, void *ptr)
 {
-	TrieRecord *tmp = NULL, *ptr = record;
+	slabFree((Slab*)arg, (SlabCache*)cache, ptr);
+}
 
-	while (ptr) {
-		tmp = ptr;
-		ptr = ptr->next;
-		free(tmp->payload);
-		free(tmp);
-	}
+/*a SHORT key is in the high half of its normalized key.*/
+#define intShift(type)	(((type) == SHORT) ? 32 : 0)
 
-	return BT_SUCCESS;
-}
 /**
- * Insert a new record to the rear of a record link.
+ * Bytes of a key stored by a container at depth, the width of its keys.
+ * A VARCHAR key is a pointer; the top depth bytes of an INT/SHORT key are
+ * the path to the container, only the rest is stored, in 8, 4, 2 or 1 bytes.
  **/
-
-BurstTrieErrCode insertRecordLink(TrieRecord **record, char **payload)
+static inline int keyWidth(KeyType type, int depth)
 {
-	TrieRecord *ptr = *record, *newrecord = NULL;
-	int cmp = 1;
-
-	if (ptr != NULL) {
-		while (ptr->next != NULL && (cmp = strcmp(ptr->payload, *payload)) != 0) {
-			ptr = ptr->next;
-		}
-
-		if (ptr->next != NULL || (cmp = strcmp(ptr->payload, *payload)) == 0)
-			return BT_ENTRY_E;
-	}
+	int rest;
 
-	newrecord = malloc(sizeof(TrieRecord));
-	newrecord->payload = malloc(sizeof(char)*MAX_PAYLOAD_LEN);
-	strcpy(newrecord->payload, *payload);
-	newrecord->next = NULL;
+	if (type == VARCHAR)
+		return sizeof(KeyVal);
 
-	*payload = newrecord->payload;
+	rest = ((type == SHORT) ? 4 : 8) - depth;
+	return ((rest > 4) ? 8 : (rest > 2) ? 4 : (rest > 1) ? 2 : 1);
+}
 
-	if (*record == NULL)
-		*record = newrecord;
-	else
-		ptr->next = newrecord;
+static inline uint64_t widthMask(int width)
+{
+	return ((width == 8) ? ~0ULL : (1ULL << (width << 3)) - 1);
+}
 
-	return BT_SUCCESS;
+/*the part of a normalized key a container of width stores: its low bytes.*/
+static inline uint64_t intPart(KeyType type, uint64_t normkey, int width)
+{
+	return (normkey >> intShift(type)) & widthMask(width);
 }
 
 /**
- *	Delete a record form a record link.
+ * The stem of a container of width holding the key: the bytes of the key
+ * above the stored part, which all the keys there share, and the width
+ * in the low byte, which is always in the stored part.
  **/
-BurstTrieErrCode deleteRecordLink(TrieRecord **record, char *payload, TrieRecord **del)
+static inline uint64_t intStem(KeyType type, uint64_t normkey, int width)
 {
-	if (*record == NULL)
-		return BT_ENTRY_NE;
-	
-	TrieRecord *ptr = *record, *pre = *record;
+	return (normkey & ~(widthMask(width) << intShift(type)) & ~0xffULL) | width;
+}
 
-	if (payload == NULL) {
-		//delete all the records!
-		*del = *record;
-		*record = NULL;
-		return BT_SUCCESS;
-	}
+/*the normalized key of a part stored by a container of stem.*/
+static inline uint64_t intKey(KeyType type, uint64_t stem, uint64_t part)
+{
+	int shift = intShift(type);
 
-	while (ptr != NULL) {
-		int cmp = strcmp(ptr->payload, payload);
+	return (stem & ~(widthMask(stem & 0xff) << shift) & ~0xffULL) | (part << shift);
+}
 
-		if (cmp == 0) {
-			*del = ptr;
-			if (pre == *record)
-				*record = ptr->next;
-			else
-				pre->next = ptr->next;
+static inline uint64_t getPart(const KeyVal *keys, int width, int i)
+{
+	switch (width) {
+		case 1:		return ((const uint8_t*)keys)[i];
+		case 2:		return ((const uint16_t*)keys)[i];
+		case 4:		return ((const uint32_t*)keys)[i];
+		default:	return ((const uint64_t*)keys)[i];
+	}
+}
 
-			(*del)->next = NULL;
+static inline void setPart(KeyVal *keys, int width, int i, uint64_t part)
+{
+	switch (width) {
+		case 1:		((uint8_t*)keys)[i] = (uint8_t)part; break;
+		case 2:		((uint16_t*)keys)[i] = (uint16_t)part; break;
+		case 4:		((uint32_t*)keys)[i] = (uint32_t)part; break;
+		default:	((uint64_t*)keys)[i] = part; break;
+	}
+}
 
-			return BT_SUCCESS;
-		}
-	} //while
+/*the i-th INT/SHORT key of a container, normalized.*/
+static inline uint64_t contIntKey(KeyType type, const TrieNode *trie, int i)
+{
+	return intKey(type, trie->Stem, getPart(trie->Keys, Width(trie), i));
+}
 
-	if (payload != NULL) //not found the expected one!
-		return BT_ENTRY_NE;
+/*move n INT/SHORT keys of a container from position from to to.*/
+static inline void moveParts(TrieNode *trie, int to, int from, int n)
+{
+	char *keys = (char*)trie->Keys;
+	int width = Width(trie);
 
+	memmove(keys + to*width, keys + from*width, n*width);
 }
+
 /**
- * Create a BurstTrie tree, also is the head pointer.
- * */
-BurstTrieErrCode createBurstTrie(BurstTrie **bt, KeyType type)
+ * A container of size keys at depth, zeroed: the keys and then the records.
+ * A VARCHAR container also keeps the heads of the keys, and the depth bytes
+ * of path, the prefix of all its keys, once behind them; its keys are only
+ * stored from depth on. The node of the container starts with the width
+ * of its keys as the stem.
+ **/
+static inline KeyVal *allocContainer(BurstTrie *bt, int size, int width, const char *path, int depth)
 {
-	*bt = (BurstTrie*)malloc(sizeof(BurstTrie));
-		
-	//Init the burst tire tree.
-	(*bt)->type = type;
-	(*bt)->trie_num = 0;
+	size_t bytes = ((size*width + 7) & ~7) + size*sizeof(TrieRecord*);
+	KeyVal *keys = NULL;
 
-	switch (type) {
-		case SHORT:
-			(*bt)->max_depth = 3;
-			(*bt)->container_size = INT_CONT_SIZE;
-			(*bt)->tree_width = INT_TREE_WIDTH;
-			(*bt)->counter_size = INT_CNT_SIZE;
-			break;
-		case INT:
-			(*bt)->max_depth = 7;
-			(*bt)->container_size = INT_CONT_SIZE;
-			(*bt)->tree_width = INT_TREE_WIDTH;
-			(*bt)->counter_size = INT_CNT_SIZE;
-			break;
-		case VARCHAR:
-			(*bt)->max_depth = MAX_PAYLOAD_LEN;
-			(*bt)->container_size = CH_CONT_SIZE;
-			(*bt)->tree_width = CH_TREE_WIDTH;
-			(*bt)->counter_size = CH_CNT_SIZE;
-			break;
-	}
+	if (bt->type == VARCHAR)
+		bytes += size*sizeof(uint64_t) + depth + 1;
 
-	int nodeType = CONTAINER;
-	if (initTrieNode(*bt, &((*bt)->root), nodeType, 0) != BT_SUCCESS) {
-		return BT_ERROR;//Will not happen now.
+	if ((keys = (KeyVal*)trieAlloc(bt, bytes)) != NULL) {
+		memset(keys, 0, bytes);
+		if (bt->type == VARCHAR)
+			memcpy(contPrefix(keys, size), path, depth);
 	}
-
-	return BT_SUCCESS;
+	return keys;
 }
 
+/*the keys of a new container at depth are keyWidth() wide.*/
+static inline KeyVal *newContainer(BurstTrie *bt, int size, const char *path, int depth)
+{
+	return allocContainer(bt, size, keyWidth(bt->type, depth), path, depth);
+}
 
 /**
- * Init a new burst trie node, if no memory yet, alloc.
- * */
-//update 26-03-2009
-//send depth to the function.
-BurstTrieErrCode initTrieNode(BurstTrie *bt, TrieNode **trie, TrieType type, int depth)
+ * The part of a VARCHAR key stored by a leaf at depth: from depth on.
+ * A key ending above the leaf is the term of a trie node instead.
+ **/
+static inline const char *keySuffix(const char *key, int depth)
 {
-	int size;
-	*trie = (TrieNode*)malloc(sizeof(TrieNode));
-	
-	memset(*trie, 0, sizeof(TrieNode));
-	(*trie)->type = type;
-	
-	switch (type) {
-		case TRIE:
-			/*Not support now!*/
-			break;
-		case CONTAINER:
-			size = ((bt->container_size) >> depth);
-			if (size < MIN_CONT)
-				size = MIN_CONT;
-			(*trie)->Cont =
-				(TrieLeaf*)malloc(size*sizeof(TrieLeaf));
-			memset((*trie)->Cont, 0, size*sizeof(TrieLeaf));
-			(*trie)->MaxSize = size;
-			break;
-		case NIL:
-			(*trie)->Nil = 
-				(TrieLeaf*)malloc(sizeof(TrieLeaf));
-			memset((*trie)->Cont, 0, sizeof(TrieLeaf));
-			break;
-	}
-		
-	return BT_SUCCESS;
+	return key + depth;
+}
+
+/*a key as a leaf at depth stores it.*/
+static inline KeyVal leafKey(KeyType type, KeyVal keyval, int depth)
+{
+	if (type == VARCHAR)
+		keyval.charkey = (char*)keySuffix(keyval.charkey, depth);
+	return keyval;
 }
 
 /**
- * Get a (Key, Payload) pair from the trie.
- * If Payload is a null pointer, return all the record with the given key.
-	
- * And also return the cursor for scanning the trie.
+ * The head of a stored VARCHAR key: its first HEAD_BYTES bytes from the
+ * top, zero padded, and its length (at most 255) in the low byte.
+ * The heads order two keys as strcmp() unless their bytes are the same;
+ * then the keys are equal, but if both are longer than HEAD_BYTES.
  **/
- BurstTrieErrCode getCursor(BurstTrie *bt, TrieCursor *cursor, Key *key) 
- {
+static inline uint64_t keyHead(const char *key)
+{
+	uint64_t head = 0;
+	size_t len;
 
-#ifdef _FULL_VERSION_
- 	if (bt == NULL || bt->root == NULL) {
-		perror("Null burst trie pointer! In getCursor.\n");
-		return BT_ERROR;
-	}
+	for (len=0; len<HEAD_BYTES && key[len] != '\0'; len++)
+		head |= (uint64_t)(uint8_t)key[len] << (56 - (len << 3));
+	if (len == HEAD_BYTES)
+		len += strlen(key + len);
 
-	if (bt->type != key->type) {
-	
-		perror("Key type not match! In getCursor.\n");
-		return BT_ERROR;
-	}
-#endif
-	//If there is no element in this burst trie tree.
-	if (bt->root->size == 0) {
-		cursor->trie = bt->root;
-		cursor->pos = -1;
-		return BT_END;
-	}
-//	if (bt->root->type == VARCHAR)
-//		return getCharKey(bt, cursor, key);
+	return head | ((len < 255) ? len : 255);
+}
 
+/*compare the heads only, 0 if the keys may still differ after them.*/
+static inline int headCmp(uint64_t head1, uint64_t head2)
+{
+	head1 >>= 8;
+	head2 >>= 8;
+	return (head1 > head2) - (head1 < head2);
+}
 
-	TrieNode *trie = bt->root, *pretrie = NULL;
-	TrieLeaf *tmp = NULL;
-	KeyVal keyval;
-	int depth = 0, pos, mid, right, left, i;
-	int64_t cmp = 0;
-		
-	setKeyVal(&keyval, key);
+/*both keys go on after the same head bytes.*/
+#define headTie(head)	(((head) & 0xff) >= HEAD_BYTES)
 
-	while (trie->type == TRIE) {
-		pos = getIndex(depth, keyval, bt->type);
-		depth ++;
+/**
+ * The keys of a VARCHAR container are front coded in one blob: an entry
+ * is the number of bytes the key shares with the one before it, then the
+ * rest of the key and '\0'. The keys are coded in blocks of at most
+ * FRONT_RESTART keys; the first entry of a block shares nothing and is
+ * marked FRONT_START, a key is decoded from the start of its block.
+ * Keys[i].charkey points to the entry of the key i, so Keys[0].charkey to
+ * the blob. A blob is never changed once the container has it, a change
+ * of the keys codes a new one.
+ **/
 
-		pretrie = trie;
-		trie = trie->Index[pos];
-		
-		if (trie == NULL) {
-			cursor->pos = pos;
-			cursor->trie = pretrie;
-			cursor->record = NULL;			
-			return BT_KEY_NF;
-		}
-		
-	}//while
+/*the first byte of the entry starting a block.*/
+#define FRONT_START	0x80
 
-	cursor->trie = trie;
-	//The case of the nil node.
-	//The string end: '\0'.
-	/**if (trie->type == NIL) {
-		cursor->pos = 0;
-		cursor->record = trie->Nil->record;
+/*the key steps entries behind the restart entry, decoded into buf.*/
+static inline const char *decodeKey(const char *entry, int steps, char *buf)
+{
+	if (steps == 0)
+		return entry + 1;
 
-		return BT_SUCCESS;
-	}*/
+	strcpy(buf, entry + 1);
+	while (steps -- > 0) {
+		entry += strlen(entry + 1) + 2;
+		strcpy(buf + (uint8_t)entry[0], entry + 1);
+	}
+	return buf;
+}
 
-	//The case of the container node. 
-	//Binary search.
-	left = mid = 0;
-	right = trie->size - 1;
+/*the start of the block holding the key at i.*/
+static inline int blockStart(const KeyVal *keys, int i)
+{
+	int low = ((i >= FRONT_RESTART) ? i - FRONT_RESTART + 1 : 0);
 
-	
-	while (left <= right) {
-		mid = (left + right) / 2;
-		tmp = &(trie->Cont[mid]);
-		keyCmp(keyval, (tmp->keyval), depth, bt->type, &cmp);
+	while (i > low && !((uint8_t)keys[i].charkey[0] & FRONT_START))
+		i --;
+	return i;
+}
 
-		if (cmp < 0)
-			right = mid - 1;
-		else if (cmp > 0)
-			left = mid + 1;
-		else {
-			cursor->pos = mid;
-			cursor->record = tmp->record;
+/*the key at i of a VARCHAR container, buf has the room of a key.*/
+static inline const char *contKey(const KeyVal *keys, int i, char *buf)
+{
+	int start = blockStart(keys, i);
 
-			return BT_SUCCESS;
-		}
-	} //while
+	return decodeKey(keys[start].charkey, i - start, buf);
+}
 
-	//If not found the key:
-	cursor->pos = right;
-	cursor->record = NULL;
+/*the bytes of the entries of the keys [i, j).*/
+static inline size_t entryBytes(const KeyVal *keys, int i, int j)
+{
+	if (i == j)
+		return 0;
+	return keys[j-1].charkey + strlen(keys[j-1].charkey + 1) + 2 - keys[i].charkey;
+}
 
-	return BT_KEY_NF;
+static inline int sharedBytes(const char *key1, const char *key2)
+{
+	int len = 0;
+
+	while (key1[len] != '\0' && key1[len] == key2[len])
+		len ++;
+	return len;
 }
 
-BurstTrieErrCode getCharKey(BurstTrie *bt, TrieCursor *cursor, Key *key) 
+/**
+ * Code the plain keys [0, n) into the entries at entry, a block starts
+ * at each key of first; keys[i] then points to the entry of the key i.
+ * The end of the entries is returned.
+ **/
+static char *codeKeys(char *entry, KeyVal *keys, int n, int first)
 {
+	const char *prev = "", *key;
+	int shared, i;
+
+	for (i=0; i<n; i++) {
+		key = keys[i].charkey;
+		shared = ((i % first == 0) ? 0 : sharedBytes(prev, key));
+		entry[0] = (char)((i % first == 0) ? FRONT_START : shared);
+		strcpy(entry + 1, key + shared);
+
+		keys[i].charkey = entry;
+		entry += strlen(entry + 1) + 2;
+		prev = key;
+	}
+	return entry;
+}
 
-	TrieNode *trie = bt->root, *pretrie = NULL;
-	TrieLeaf *tmp = NULL;
-	char *keyval = &(key->keyval.charkey[0]);
-	int depth = 0, pos, mid, right, left, cmp, i;
-		
+/*the bytes codeKeys() takes for the plain keys [0, n).*/
+static size_t codedBytes(const KeyVal *keys, int n, int first)
+{
+	const char *prev = "", *key;
+	size_t bytes = 0;
+	int shared, i;
+
+	for (i=0; i<n; i++) {
+		key = keys[i].charkey;
+		shared = ((i % first == 0) ? 0 : sharedBytes(prev, key));
+		bytes += strlen(key + shared) + 2;
+		prev = key;
+	}
+	return bytes;
+}
 
-	while (trie->type == TRIE) {
-		pos = *keyval ++;
-		depth ++;
+/**
+ * Code the plain keys [0, n) into a new blob: keys[i] then points to the
+ * entry of the key i, and heads[i] is its head.
+ **/
+static void packKeys(BurstTrie *bt, KeyVal *keys, uint64_t *heads, int n)
+{
+	char *entry;
+	int i;
 
-		if (pos != 0)
-			pos -= 64;
+	if (n == 0 || (entry = (char*)trieAlloc(bt, codedBytes(keys, n, FRONT_RESTART))) == NULL)
+		return;
 
-		pretrie = trie;
-		trie = trie->Index[pos];
+	for (i=0; i<n; i++)
+		heads[i] = keyHead(keys[i].charkey);
+	codeKeys(entry, keys, n, FRONT_RESTART);
+}
+
+/*decode the n keys of a VARCHAR container into buf, keys point to them.*/
+static void unpackKeys(const KeyVal *from, int n, KeyVal *keys, char *buf)
+{
+	const char *entry, *prev = "";
+	int shared, i;
+
+	for (i=0; i<n; i++) {
+		entry = from[i].charkey;
+		shared = (uint8_t)entry[0] & (FRONT_START - 1);
+		memcpy(buf, prev, shared);
+		strcpy(buf + shared, entry + 1);
+
+		keys[i].charkey = buf;
+		prev = buf;
+		buf += strlen(buf) + 1;
+	}
+}
+
+/**
+ * Code the keys of a VARCHAR container again, with key (from the depth
+ * of the container) inserted at i, or without the key at i if key is
+ * NULL. Only the block the change lands in is coded again, split in two
+ * when it outgrows FRONT_RESTART; the entries of the other blocks are
+ * copied into the new blob as they are. The old blob is retired; the
+ * records and the size are left.
+ **/
+static void recodeKeys(BurstTrie *bt, TrieNode *trie, int i, const char *key)
+{
+	KeyVal keys[FRONT_RESTART + 1];
+	char buf[(FRONT_RESTART + 1)*(MAX_VARCHAR_LEN + 1)];
+	KeyVal *old = trie->Keys;
+	char *blob = ((trie->size > 0) ? old[0].charkey : NULL), *entry, *base;
+	size_t before, after, bytes;
+	int n = trie->size, start, end, first, m, j;
+
+	//the block [start, end) the key goes into or is taken from.
+	start = blockStart(old, (key != NULL && i > 0) ? i - 1 : i);
+	for (end = start; end < n; end ++)
+		if (end > start && ((uint8_t)old[end].charkey[0] & FRONT_START))
+			break;
+
+	m = end - start;
+	unpackKeys(&(old[start]), m, keys, buf);
+	if (key != NULL) {
+		memmove(&(keys[i-start+1]), &(keys[i-start]), (end-i)*sizeof(KeyVal));
+		keys[i-start].charkey = (char*)key;
+		m ++;
+	}
+	else {
+		m --;
+		memmove(&(keys[i-start]), &(keys[i-start+1]), (end-i-1)*sizeof(KeyVal));
+	}
+	first = ((m > FRONT_RESTART) ? (m + 1) / 2 : FRONT_RESTART);
+
+	before = entryBytes(old, 0, start);
+	after = entryBytes(old, end, n);
+	bytes = codedBytes(keys, m, first);
+	entry = NULL;
+	if (before + bytes + after > 0 && 
+			(entry = (char*)trieAlloc(bt, before + bytes + after)) == NULL)
+		return;
+
+	//the blocks behind move by one key, their entries as they are.
+	if (after > 0) {
+		base = old[end].charkey;
+		memcpy(entry + before + bytes, base, after);
+		if (key != NULL) {
+			for (j=n-1; j>=end; j--)
+				old[j+1].charkey = entry + before + bytes + (old[j].charkey - base);
+		}
+		else {
+			for (j=end; j<n; j++)
+				old[j-1].charkey = entry + before + bytes + (old[j].charkey - base);
+		}
+	}
+	if (before > 0) {
+		memcpy(entry, blob, before);
+		for (j=0; j<start; j++)
+			old[j].charkey = entry + (old[j].charkey - blob);
+	}
+	codeKeys(entry + before, keys, m, first);
+	memcpy(&(old[start]), keys, m*sizeof(KeyVal));
+
+	if (key != NULL) {
+		memmove(&(Heads(trie)[i+1]), &(Heads(trie)[i]), (n-i)*sizeof(uint64_t));
+		Heads(trie)[i] = keyHead(key);
+	}
+	else
+		memmove(&(Heads(trie)[i]), &(Heads(trie)[i+1]), (n-i-1)*sizeof(uint64_t));
+
+	if (blob != NULL)
+		epochRetire(&(bt->epoch), blob);
+}
+
+/**
+ * Set a key (of a VARCHAR leaf, from its depth on) at i of a container.
+ * A VARCHAR key is only referred to in a new container, packLeaf() codes
+ * them all at the end; an INT/SHORT key also sets the stem.
+ **/
+static inline void setLeafKey(BurstTrie *bt, TrieNode *trie, int i, KeyVal keyval)
+{
+	int width = Width(trie);
+
+	if (bt->type == VARCHAR)
+		trie->Keys[i].charkey = keyval.charkey;
+	else {
+		trie->Stem = intStem(bt->type, keyval.normkey, width);
+		setPart(trie->Keys, width, i, intPart(bt->type, keyval.normkey, width));
+	}
+}
+
+static inline void packLeaf(BurstTrie *bt, TrieNode *trie)
+{
+	if (bt->type == VARCHAR)
+		packKeys(bt, trie->Keys, Heads(trie), trie->size);
+}
+
+/**
+ * The optimistic lock coupling on the node version.
+ * A reader remembers the version, reads the node, and checks the version
+ * again before trusting anything it has read; a writer sets the lock bit
+ * with a CAS, and bumps the counter when unlocks.
+ * Nobody waits on a locked node, the whole operation restarts instead.
+ */
+static inline int readLockNode(TrieNode *trie, uint32_t *version)
+{
+	*version = __atomic_load_n(&(trie->version), __ATOMIC_ACQUIRE);
+	return (*version & (OLC_LOCKED | OLC_OBSOLETE)) == 0;
+}
+
+static inline int checkNode(TrieNode *trie, uint32_t version)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&(trie->version), __ATOMIC_RELAXED) == version;
+}
+
+static inline int upgradeNode(TrieNode *trie, uint32_t version)
+{
+	return __atomic_compare_exchange_n(&(trie->version), &version, 
+			version + OLC_LOCKED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline int tryLockNode(TrieNode *trie)
+{
+	uint32_t version;
+	return readLockNode(trie, &version) && upgradeNode(trie, version);
+}
+
+static inline void unlockNode(TrieNode *trie)
+{
+	__atomic_fetch_add(&(trie->version), OLC_LOCKED, __ATOMIC_RELEASE);
+}
+
+/*the node has been unlinked, the readers still on it must restart.*/
+static inline void unlockObsoleteNode(TrieNode *trie)
+{
+	__atomic_fetch_add(&(trie->version), OLC_LOCKED | OLC_OBSOLETE, __ATOMIC_RELEASE);
+}
+
+static inline void backoff(int retry)
+{
+	if (retry > 1)
+		sched_yield();
+}
+
+static inline BurstTrieErrCode reSizeContainer(BurstTrie *bt, TrieNode *trie, int container_size, int depth)
+{
+	if (depth == 0 || trie->MaxSize >= container_size)
+		return BT_ERROR;
+	int size = (container_size >> depth);
+	if (size < MIN_CONT)
+		size = MIN_CONT;
+
+	size += trie->MaxSize;
+	KeyVal *tmp = trie->Keys, *keys = NULL;
+
+	//not realloc, an optimistic reader may still be on the old one.
+	if ((keys = newContainer(bt, size, Prefix(trie), depth)) == NULL) 
+		return BT_ERROR;
+	
+	memcpy(keys, tmp, Width(trie)*(trie->MaxSize));
+	memcpy(contRecords(keys, size, Width(trie)), Records(trie), 
+			sizeof(TrieRecord*)*(trie->MaxSize));
+	if (bt->type == VARCHAR)
+		memcpy(contHeads(keys, size), Heads(trie), 
+				sizeof(uint64_t)*(trie->MaxSize));
+	trie->Keys = keys;
+	trie->MaxSize = size;
+	epochRetire(&(bt->epoch), tmp);
+
+	return BT_SUCCESS;
+	
+}
+
+/**
+ * Normalize a key of the API: an INT key with its sign flipped, a SHORT
+ * key the same in the high 32 bits; so they sort as unsigned integers,
+ * and the position at a depth is just the byte from the top.
+ * A VARCHAR key points to the string of key.
+ **/
+static inline void setKeyValType(KeyVal *keyval, const Key *key, KeyType type)
+{
+	switch (type) {
+		case SHORT:	
+			keyval->normkey = ((uint64_t)(uint32_t)key->keyval.shortkey << 32) ^ INT_SIGN; 
+			return;
+		case INT:	
+			keyval->normkey = (uint64_t)key->keyval.intkey ^ INT_SIGN; 
+			return;
+		case VARCHAR:	
+			keyval->charkey = (char*)&(key->keyval.charkey[0]); 
+			return;
+	}
+}
+
+void setKeyVal(KeyVal *keyval, const Key *key)
+{
+	setKeyValType(keyval, key, key->type);
+}
+
+/**
+ * Give a key of the trie back to the API, the reverse of setKeyVal();
+ * a VARCHAR key of a leaf is the prefix of the leaf and the stored part.
+ **/
+static inline void getKeyVal(KeyType type, KeyVal keyval, const char *prefix, Key *key)
+{
+	size_t len;
+
+	switch (type) {
+		case SHORT:
+			key->keyval.intkey = (int32_t)((keyval.normkey ^ INT_SIGN) >> 32);
+			break;
+		case INT:
+			key->keyval.intkey = (int64_t)(keyval.normkey ^ INT_SIGN);
+			break;
+		case VARCHAR:
+			len = strlen(prefix);
+			memcpy(&(key->keyval.charkey[0]), prefix, len);
+			strcpy(&(key->keyval.charkey[len]), keyval.charkey);
+			break;
+	}
+	key->type = type;
+}
+
+/**
+ * Use to get the position in the trie in-node index.
+ */
+uint8_t inline getIndex(int depth, KeyVal keyval, KeyType type)
+{
+	uint8_t pos;
+	
+	if (type != VARCHAR)
+		return (uint8_t)(keyval.normkey >> (56 - (depth << 3)));
+
+	//the whole byte, '\0' is the nil node.
+	pos = (uint8_t)(keyval.charkey[depth]);
+	return pos;
+}
+
+
+/**
+ * Compare two KeyVal type elements key1 and key2.
+ * A VARCHAR key2 is a key of a leaf at depth, stored from there.
+ * if key1 > key2 return a postive number;
+ * else if key1 < key2 return a negtive one;
+ * else 0 should be returned.
+ **/
+void inline keyCmp(KeyVal key1, KeyVal key2, int depth, KeyType type, int64_t *cmp) 
+{
+	switch (type) {
+		case SHORT:
+		case INT:
+			//not a difference, it would overflow.
+			*cmp = (key1.normkey > key2.normkey) - (key1.normkey < key2.normkey);
+			break;
+		case VARCHAR:
+			*cmp = strcmp(key1.charkey+depth, key2.charkey);
+			break;
+		//default :
+			
+	}
+	
+}
+
+/**
+ * Count the keys of the window keys[0, n) less than key.
+ * The window is short and sorted, so the count is where the key goes;
+ * the vector kernels compare all of it, no branch to mispredict.
+ **/
+static int countLessScalar(const uint64_t *keys, int n, uint64_t key)
+{
+	int i, count = 0;
+
+	for (i=0; i<n; i++)
+		count += (keys[i] < key);
+	return count;
+}
+
+#if defined(_SIMD_SEARCH_) && defined(__x86_64__)
+__attribute__((target("avx2,popcnt")))
+static int countLessAVX2(const uint64_t *keys, int n, uint64_t key)
+{
+	//there is no unsigned compare, flip the signs and compare signed.
+	__m256i sign = _mm256_set1_epi64x((int64_t)INT_SIGN);
+	__m256i k = _mm256_set1_epi64x((int64_t)(key ^ INT_SIGN)), v;
+	int i, count = 0;
+
+	for (i=0; i+4<=n; i+=4) {
+		v = _mm256_loadu_si256((const __m256i*)(keys + i));
+		v = _mm256_cmpgt_epi64(k, _mm256_xor_si256(v, sign));
+		count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(v)));
+	}
+	for (; i<n; i++)
+		count += (keys[i] < key);
+	return count;
+}
+
+__attribute__((target("avx512f,popcnt")))
+static int countLessAVX512(const uint64_t *keys, int n, uint64_t key)
+{
+	__m512i k = _mm512_set1_epi64((int64_t)key), v;
+	__mmask8 m;
+	int i, count = 0;
+
+	//the masked load does not touch the keys behind the window.
+	for (i=0; i<n; i+=8) {
+		m = ((n - i >= 8) ? 0xff : (__mmask8)((1u << (n - i)) - 1));
+		v = _mm512_maskz_loadu_epi64(m, keys + i);
+		count += __builtin_popcount(_mm512_mask_cmplt_epu64_mask(m, v, k));
+	}
+	return count;
+}
+#endif
+
+static int (*countLess)(const uint64_t *keys, int n, uint64_t key) = countLessScalar;
+static pthread_once_t count_once = PTHREAD_ONCE_INIT;
+
+static void selectCountLess(void)
+{
+#if defined(_SIMD_SEARCH_) && defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		countLess = countLessAVX512;
+	else if (__builtin_cpu_supports("avx2"))
+		countLess = countLessAVX2;
+#endif
+}
+
+/**
+ * The position of the first INT/SHORT key part not less than part in the
+ * sorted keys[0, n) of width bytes: halve the range without a branch down
+ * to a window, then count in the window.
+ **/
+static inline int rankKeys(const KeyVal *keys, int width, int n, uint64_t part)
+{
+	const void *window;
+	int base = 0, half, i, count = 0;
+
+	while (n > SEARCH_WINDOW) {
+		half = n / 2;
+		base += ((getPart(keys, width, base + half - 1) < part) ? half : 0);
+		n -= half;
+	}
+
+	window = (const char*)keys + base*width;
+	switch (width) {
+		case 1:
+			for (i=0; i<n; i++)
+				count += (((const uint8_t*)window)[i] < part);
+			break;
+		case 2:
+			for (i=0; i<n; i++)
+				count += (((const uint16_t*)window)[i] < part);
+			break;
+		case 4:
+			for (i=0; i<n; i++)
+				count += (((const uint32_t*)window)[i] < part);
+			break;
+		default:
+			count = countLess((const uint64_t*)window, n, part);
+			break;
+	}
+
+	return base + count;
+}
+
+/**
+ * Find the key in the sorted keys of a container at depth.
+ * Return 1 and its position in *pos if it is there,
+ * else 0 and the position it would be inserted at.
+ * A VARCHAR key is compared by the heads first.
+ **/
+static inline int findKey(KeyType type, TrieNode *trie, KeyVal keyval, 
+		int depth, int *pos)
+{
+	KeyVal *keys = trie->Keys;
+	const uint64_t *heads;
+	const char *key;
+	char buf[MAX_VARCHAR_LEN + 2];
+	uint64_t head, part;
+	int left = 0, right = trie->size - 1, mid, cmp, width;
+
+	//an INT/SHORT container is searched by the stored parts.
+	if (type != VARCHAR) {
+		width = Width(trie);
+		part = intPart(type, keyval.normkey, width);
+		*pos = rankKeys(keys, width, trie->size, part);
+		return (*pos < trie->size && getPart(keys, width, *pos) == part);
+	}
+
+	key = keyval.charkey + depth;
+	head = keyHead(key);
+	heads = Heads(trie);
+
+	while (left <= right) {
+		mid = (left + right) / 2;
+		cmp = headCmp(head, heads[mid]);
+		if (cmp == 0 && headTie(head))
+			cmp = strcmp(key + HEAD_BYTES, contKey(keys, mid, buf) + HEAD_BYTES);
+
+		if (cmp < 0)
+			right = mid - 1;
+		else if (cmp > 0)
+			left = mid + 1;
+		else {
+			*pos = mid;
+			return 1;
+		}
+	} //while
+
+	*pos = left;
+	return 0;
+}
+
+/**
+ * Find the child of a trie node at position pos, NULL if not exist.
+ **/
+static inline TrieNode *findChild(TrieNode *trie, int pos)
+{
+	int i;
+
+	switch (trie->Kind) {
+		case NODE4:
+			for (i=0; i<trie->size; i++) {
+				if (trie->Node4->keys[i] == pos)
+					return trie->Node4->child[i];
+			}
+			return NULL;
+
+		case NODE16:
+#ifdef __SSE2__
+			{
+				__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)pos),
+						_mm_loadu_si128((__m128i*)trie->Node16->keys));
+				int mask = _mm_movemask_epi8(cmp) & ((1 << trie->size) - 1);
+
+				return mask ? trie->Node16->child[__builtin_ctz(mask)] : NULL;
+			}
+#else
+			for (i=0; i<trie->size; i++) {
+				if (trie->Node16->keys[i] == pos)
+					return trie->Node16->child[i];
+			}
+			return NULL;
+#endif
+
+		case NODE48:
+			i = trie->Node48->index[pos];
+			return (i != 0) ? trie->Node48->child[i-1] : NULL;
+
+		case NODE256:
+			return trie->Node256->child[pos];
+	}
+
+	return NULL;
+}
+
+/**
+ * Get the first set bit at a position >= pos in the occupancy bitmap,
+ * -1 if there is none.
+ **/
+static inline int bitmapNext(const uint64_t *bitmap, int pos, int tree_width)
+{
+	int i = pos >> 6, n = tree_width >> 6;
+	uint64_t word;
+
+	if (pos >= tree_width)
+		return -1;
+
+	word = bitmap[i] & (~0ULL << (pos & 63));
+	while (word == 0) {
+		if (++i >= n)
+			return -1;
+		word = bitmap[i];
+	}
+
+	return (i << 6) + __builtin_ctzll(word);
+}
+
+/**
+ * Get the last set bit at a position <= pos in the occupancy bitmap,
+ * -1 if there is none.
+ **/
+static inline int bitmapPrev(const uint64_t *bitmap, int pos)
+{
+	int i = pos >> 6;
+	uint64_t word;
+
+	if (pos < 0)
+		return -1;
+
+	word = bitmap[i] & (~0ULL >> (63 - (pos & 63)));
+	while (word == 0) {
+		if (--i < 0)
+			return -1;
+		word = bitmap[i];
+	}
+
+	return (i << 6) + 63 - __builtin_clzll(word);
+}
+
+#define bitmapSet(bitmap, pos)		(bitmap)[(pos) >> 6] |= (1ULL << ((pos) & 63))
+#define bitmapClear(bitmap, pos)	(bitmap)[(pos) >> 6] &= ~(1ULL << ((pos) & 63))
+
+/**
+ * Get the first child at a position >= pos,
+ * return the position, or -1 if there is no such child.
+ **/
+static int nextChild(BurstTrie *bt, TrieNode *trie, int pos, TrieNode **child)
+{
+	int i, n = trie->size;
+
+	if (pos < 0)
+		pos = 0;
+
+	switch (trie->Kind) {
+		case NODE4:
+			for (i=0; i<n; i++) {
+				if (trie->Node4->keys[i] >= pos) {
+					*child = trie->Node4->child[i];
+					return trie->Node4->keys[i];
+				}
+			}
+			break;
+
+		case NODE16:
+			if (pos >= bt->tree_width)
+				break;
+#ifdef __SSE2__
+			{
+				//keys[i] >= pos  <=>  max(keys[i], pos) == keys[i]
+				__m128i keys = _mm_loadu_si128((__m128i*)trie->Node16->keys);
+				__m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(keys, _mm_set1_epi8((char)pos)), keys);
+				int mask = _mm_movemask_epi8(ge) & ((1 << n) - 1);
+
+				if (mask == 0)
+					break;
+				i = __builtin_ctz(mask);
+			}
+#else
+			for (i=0; i<n && trie->Node16->keys[i]<pos; i++)
+				;
+			if (i == n)
+				break;
+#endif
+			*child = trie->Node16->child[i];
+			return trie->Node16->keys[i];
+
+		case NODE48:
+			if ((i = bitmapNext(trie->Node48->bitmap, pos, bt->tree_width)) >= 0) {
+				*child = trie->Node48->child[trie->Node48->index[i]-1];
+				return i;
+			}
+			break;
+
+		case NODE256:
+			if ((i = bitmapNext(trie->Node256->bitmap, pos, bt->tree_width)) >= 0) {
+				*child = trie->Node256->child[i];
+				return i;
+			}
+			break;
+	}
+
+	return -1;
+}
+
+/**
+ * Get the last child at a position <= pos,
+ * return the position, or -1 if there is no such child.
+ **/
+static int prevChild(BurstTrie *bt, TrieNode *trie, int pos, TrieNode **child)
+{
+	int i, n = trie->size;
+
+	if (pos >= bt->tree_width)
+		pos = bt->tree_width - 1;
+
+	switch (trie->Kind) {
+		case NODE4:
+			for (i=n-1; i>=0; i--) {
+				if (trie->Node4->keys[i] <= pos) {
+					*child = trie->Node4->child[i];
+					return trie->Node4->keys[i];
+				}
+			}
+			break;
+
+		case NODE16:
+			if (pos < 0)
+				break;
+#ifdef __SSE2__
+			{
+				//keys[i] <= pos  <=>  min(keys[i], pos) == keys[i]
+				__m128i keys = _mm_loadu_si128((__m128i*)trie->Node16->keys);
+				__m128i le = _mm_cmpeq_epi8(_mm_min_epu8(keys, _mm_set1_epi8((char)pos)), keys);
+				int mask = _mm_movemask_epi8(le) & ((1 << n) - 1);
+
+				if (mask == 0)
+					break;
+				i = 31 - __builtin_clz(mask);
+			}
+#else
+			for (i=n-1; i>=0 && trie->Node16->keys[i]>pos; i--)
+				;
+			if (i < 0)
+				break;
+#endif
+			*child = trie->Node16->child[i];
+			return trie->Node16->keys[i];
+
+		case NODE48:
+			if ((i = bitmapPrev(trie->Node48->bitmap, pos)) >= 0) {
+				*child = trie->Node48->child[trie->Node48->index[i]-1];
+				return i;
+			}
+			break;
+
+		case NODE256:
+			if ((i = bitmapPrev(trie->Node256->bitmap, pos)) >= 0) {
+				*child = trie->Node256->child[i];
+				return i;
+			}
+			break;
+	}
+
+	return -1;
+}
+
+/**
+ * Build the index of a trie node from a tree_width array of children,
+ * using the smallest node kind that can hold num children.
+ * The old index (if any) must be released by the caller.
+ **/
+static void buildTrieIndex(BurstTrie *bt, TrieNode *trie, TrieNode **children, int num)
+{
+	int i, n = 0,
+		tree_width = bt->tree_width;
+	size_t size;
+
+	trie->Head = tree_width;
+	trie->Rear = 0;
+
+	if (num <= NODE16_SIZE) {
+		uint8_t *keys;
+		TrieNode **ptr;
+
+		if (num <= NODE4_SIZE) {
+			trie->Kind = NODE4;
+			size = sizeof(TrieNode4);
+		}
+		else {
+			trie->Kind = NODE16;
+			size = sizeof(TrieNode16);
+		}
+		trie->Index = trieAlloc(bt, size);
+		memset(trie->Index, 0, size);
+
+		if (trie->Kind == NODE4) {
+			keys = trie->Node4->keys;
+			ptr = trie->Node4->child;
+		}
+		else {
+			keys = trie->Node16->keys;
+			ptr = trie->Node16->child;
+		}
+
+		for (i=0; i<tree_width; i++) {
+			if (children[i] != NULL) {
+				keys[n] = i;
+				ptr[n] = children[i];
+				n ++;
+			}
+		}
+	}
+	else if (num <= NODE48_SIZE) {
+		trie->Kind = NODE48;
+		trie->Node48 = trieAlloc(bt, sizeof(TrieNode48));
+		memset(trie->Node48, 0, sizeof(TrieNode48));
+
+		for (i=0; i<tree_width; i++) {
+			if (children[i] != NULL) {
+				trie->Node48->child[n] = children[i];
+				trie->Node48->index[i] = ++n;
+				bitmapSet(trie->Node48->bitmap, i);
+			}
+		}
+	}
+	else {
+		trie->Kind = NODE256;
+		size = sizeof(TrieNode256) + tree_width*sizeof(TrieNode*);
+		trie->Node256 = trieAlloc(bt, size);
+		memset(trie->Node256, 0, size);
+
+		for (i=0; i<tree_width; i++) {
+			if (children[i] != NULL) {
+				trie->Node256->child[i] = children[i];
+				bitmapSet(trie->Node256->bitmap, i);
+			}
+		}
+	}
+
+	for (i=0; i<tree_width; i++) {
+		if (children[i] != NULL) {
+			if (trie->Head > i)
+				trie->Head = i;
+			trie->Rear = i;
+		}
+	}
+
+	trie->size = num;
+}
+
+/**
+ * Copy the children of a trie node to a tree_width array.
+ **/
+static void expandTrieIndex(BurstTrie *bt, TrieNode *trie, TrieNode **children)
+{
+	int i;
+
+	memset(children, 0, bt->tree_width*sizeof(TrieNode*));
+
+	switch (trie->Kind) {
+		case NODE4:
+			for (i=0; i<trie->size; i++)
+				children[trie->Node4->keys[i]] = trie->Node4->child[i];
+			break;
+		case NODE16:
+			for (i=0; i<trie->size; i++)
+				children[trie->Node16->keys[i]] = trie->Node16->child[i];
+			break;
+		case NODE48:
+			for (i=0; i<bt->tree_width; i++)
+				if (trie->Node48->index[i] != 0)
+					children[i] = trie->Node48->child[trie->Node48->index[i]-1];
+			break;
+		case NODE256:
+			memcpy(children, trie->Node256->child, bt->tree_width*sizeof(TrieNode*));
+			break;
+	}
+}
+
+/**
+ * Re-build the index of a trie node with a suitable node kind.
+ **/
+static void reKindTrieIndex(BurstTrie *bt, TrieNode *trie, int pos, TrieNode *child, int num)
+{
+	TrieNode *children[INT_TREE_WIDTH];
+
+	expandTrieIndex(bt, trie, children);
+	children[pos] = child;
+
+	epochRetire(&(bt->epoch), trie->Index);
+	buildTrieIndex(bt, trie, children, num);
+}
+
+/**
+ * Insert a child at position pos (empty now) into a trie node,
+ * grow the node if it is full.
+ **/
+static void addChild(BurstTrie *bt, TrieNode *trie, int pos, TrieNode *child)
+{
+	int i, n = trie->size;
+	uint8_t *keys;
+	TrieNode **ptr;
+
+	switch (trie->Kind) {
+		case NODE4:
+		case NODE16:
+			if (n >= (trie->Kind == NODE4 ? NODE4_SIZE : NODE16_SIZE)) {
+				reKindTrieIndex(bt, trie, pos, child, n+1);
+				return;
+			}
+			if (trie->Kind == NODE4) {
+				keys = trie->Node4->keys;
+				ptr = trie->Node4->child;
+			}
+			else {
+				keys = trie->Node16->keys;
+				ptr = trie->Node16->child;
+			}
+			for (i=n; i>0 && keys[i-1]>pos; i--) {
+				keys[i] = keys[i-1];
+				ptr[i] = ptr[i-1];
+			}
+			keys[i] = pos;
+			ptr[i] = child;
+			break;
+
+		case NODE48:
+			if (n >= NODE48_SIZE) {
+				reKindTrieIndex(bt, trie, pos, child, n+1);
+				return;
+			}
+			for (i=0; trie->Node48->child[i]!=NULL; i++)
+				;
+			trie->Node48->child[i] = child;
+			trie->Node48->index[pos] = i + 1;
+			bitmapSet(trie->Node48->bitmap, pos);
+			break;
+
+		case NODE256:
+			trie->Node256->child[pos] = child;
+			bitmapSet(trie->Node256->bitmap, pos);
+			break;
+	}
+
+	if (n == 0) {
+		trie->Head = trie->Rear = pos;
+	}
+	else {
+		if (pos < trie->Head)
+			trie->Head = pos;
+		if (pos > trie->Rear)
+			trie->Rear = pos;
+	}
+	trie->size ++;
+}
+
+/**
+ * Remove the child at position pos from a trie node,
+ * shrink the node if it becomes sparse.
+ **/
+static void removeChild(BurstTrie *bt, TrieNode *trie, int pos)
+{
+	int i, n = trie->size;
+	uint8_t *keys;
+	TrieNode **ptr, *child;
+
+	switch (trie->Kind) {
+		case NODE4:
+		case NODE16:
+			if (trie->Kind == NODE4) {
+				keys = trie->Node4->keys;
+				ptr = trie->Node4->child;
+			}
+			else {
+				keys = trie->Node16->keys;
+				ptr = trie->Node16->child;
+			}
+			for (i=0; i<n && keys[i]!=pos; i++)
+				;
+			for (; i<n-1; i++) {
+				keys[i] = keys[i+1];
+				ptr[i] = ptr[i+1];
+			}
+			break;
+
+		case NODE48:
+			i = trie->Node48->index[pos];
+			trie->Node48->child[i-1] = NULL;
+			trie->Node48->index[pos] = 0;
+			bitmapClear(trie->Node48->bitmap, pos);
+			break;
+
+		case NODE256:
+			trie->Node256->child[pos] = NULL;
+			bitmapClear(trie->Node256->bitmap, pos);
+			break;
+	}
+
+	trie->size --;
+	if (trie->size == 0)
+		return;
+
+	if ((trie->Kind == NODE256 && trie->size < NODE256_MIN) ||
+		(trie->Kind == NODE48 && trie->size < NODE48_MIN) ||
+		(trie->Kind == NODE16 && trie->size < NODE16_MIN)) {
+		reKindTrieIndex(bt, trie, pos, NULL, trie->size);
+		return;
+	}
+
+	//update the head rear pointers!
+	if (trie->Head == pos)
+		trie->Head = nextChild(bt, trie, pos, &child);
+	if (trie->Rear == pos)
+		trie->Rear = prevChild(bt, trie, pos, &child);
+}
+
+/*FNV-1a of a payload.*/
+static inline uint32_t payloadHash(const char *payload, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i=0; i<len; i++)
+		hash = (hash ^ (uint8_t)payload[i]) * 16777619u;
+	return hash;
+}
+
+static inline PoolStripe *poolStripe(BurstTrie *bt, uint32_t hash)
+{
+	return &(bt->pool->stripes[hash >> POOL_SHIFT]);
+}
+
+/**
+ * Double the buckets of a stripe, with its lock held.
+ * Only the holders of the lock read the buckets, the old ones are freed
+ * at once.
+ **/
+static void growStripe(BurstTrie *bt, PoolStripe *stripe)
+{
+	uint32_t size = (stripe->mask + 1) * 2, i;
+	SharedPayload **buckets = (SharedPayload**)trieAlloc(bt, size*sizeof(SharedPayload*));
+	SharedPayload *ptr = NULL, *next = NULL;
+
+	memset(buckets, 0, size*sizeof(SharedPayload*));
+	for (i=0; i<=stripe->mask; i++) {
+		for (ptr = stripe->buckets[i]; ptr != NULL; ptr = next) {
+			next = ptr->next;
+			ptr->next = buckets[ptr->hash & (size - 1)];
+			buckets[ptr->hash & (size - 1)] = ptr;
+		}
+	}
+
+	slabFree(&(bt->slab), trieCaches(bt), stripe->buckets);
+	stripe->buckets = buckets;
+	stripe->mask = size - 1;
+}
+
+/*take a reference to the shared copy of a payload, made if there is none.*/
+static SharedPayload *internPayload(BurstTrie *bt, const char *payload, size_t len)
+{
+	uint32_t hash = payloadHash(payload, len);
+	PoolStripe *stripe = poolStripe(bt, hash);
+	SharedPayload *ptr = NULL, **bucket = NULL;
+
+	pthread_mutex_lock(&(stripe->lock));
+
+	bucket = &(stripe->buckets[hash & stripe->mask]);
+	for (ptr = *bucket; ptr != NULL; ptr = ptr->next) {
+		if (ptr->hash == hash && ptr->len == len && memcmp(ptr->payload, payload, len) == 0)
+			break;
+	}
+
+	if (ptr == NULL) {
+		ptr = (SharedPayload*)trieAlloc(bt, sizeof(SharedPayload) + len + 1);
+		ptr->hash = hash;
+		ptr->refs = 0;
+		ptr->len = len;
+		memcpy(ptr->payload, payload, len + 1);
+		ptr->next = *bucket;
+		*bucket = ptr;
+		if (++ stripe->num > stripe->mask + 1)
+			growStripe(bt, stripe);
+	}
+	ptr->refs ++;
+
+	pthread_mutex_unlock(&(stripe->lock));
+
+	return ptr;
+}
+
+/**
+ * Drop a reference to a shared payload, the last one takes it out of the
+ * pool and retires it: the readers of the records still see it.
+ **/
+static void dropPayload(BurstTrie *bt, SharedPayload *shared)
+{
+	PoolStripe *stripe = poolStripe(bt, shared->hash);
+	SharedPayload **pre = NULL;
+
+	pthread_mutex_lock(&(stripe->lock));
+
+	if (-- shared->refs == 0) {
+		pre = &(stripe->buckets[shared->hash & stripe->mask]);
+		while (*pre != shared)
+			pre = &((*pre)->next);
+		*pre = shared->next;
+		stripe->num --;
+		epochRetire(&(bt->epoch), shared);
+	}
+
+	pthread_mutex_unlock(&(stripe->lock));
+}
+
+/*a record of the payload, linked to nothing.*/
+static TrieRecord *newRecord(BurstTrie *bt, const char *payload, size_t len)
+{
+	TrieRecord *record = NULL;
+
+	if (bt->pool != NULL) {
+		record = (TrieRecord*)trieAlloc(bt, sizeof(SharedRecord));
+		((SharedRecord*)record)->shared = internPayload(bt, payload, len);
+	}
+	else {
+		record = (TrieRecord*)trieAlloc(bt, sizeof(TrieRecord) + len + 1);
+		record->len = len;
+		memcpy(record->payload, payload, len + 1);
+	}
+	record->next = NULL;
+
+	return record;
+}
+
+/**
+ * release the memory space of the deleted record link,
+ * and the references of its records to the shared payloads.
+ */
+BurstTrieErrCode freeRecordLink(BurstTrie *bt, TrieRecord *record) 
+{
+	TrieRecord *tmp = NULL, *ptr = record;
+
+	while (ptr) {
+		tmp = ptr;
+		ptr = ptr->next;
+		if (bt->pool != NULL)
+			dropPayload(bt, ((SharedRecord*)tmp)->shared);
+		epochRetire(&(bt->epoch), tmp);
+	}
+
+	return BT_SUCCESS;
+}
+
+/**
+ * Let an empty trie share its payloads from now on.
+ * The records of a trie are all of one layout, so a trie with keys
+ * (or nodes above its root container) keeps its own copies.
+ **/
+BurstTrieErrCode sharePayloadsBurstTrie(BurstTrie *bt)
+{
+	PayloadPool *pool = NULL;
+	PoolStripe *stripe = NULL;
+	int i;
+
+	if (bt->pool != NULL)
+		return BT_SUCCESS;
+	if (bt->root->type != CONTAINER || bt->root->size != 0)
+		return BT_ERROR;
+
+	pool = (PayloadPool*)malloc(sizeof(PayloadPool));
+	for (i=0; i<POOL_STRIPES; i++) {
+		stripe = &(pool->stripes[i]);
+		pthread_mutex_init(&(stripe->lock), NULL);
+		stripe->buckets = (SharedPayload**)trieAlloc(bt, POOL_MIN_SIZE*sizeof(SharedPayload*));
+		memset(stripe->buckets, 0, POOL_MIN_SIZE*sizeof(SharedPayload*));
+		stripe->mask = POOL_MIN_SIZE - 1;
+		stripe->num = 0;
+	}
+
+	__atomic_store_n(&(bt->pool), pool, __ATOMIC_RELEASE);
+
+	return BT_SUCCESS;
+}
+
+/*the same payload, by the length first.*/
+static inline int samePayload(BurstTrie *bt, const TrieRecord *record, const char *payload, size_t len)
+{
+	return (recordLen(bt, record) == len && memcmp(recordPayload(bt, record), payload, len) == 0);
+}
+
+/*the hash of the payload of a record, kept by a shared one.*/
+static inline uint32_t recordHash(BurstTrie *bt, const TrieRecord *record)
+{
+	if (bt->pool != NULL)
+		return ((const SharedRecord*)record)->shared->hash;
+	return payloadHash(record->payload, record->len);
+}
+
+/*the slot of a key points to its RecordSet if the low bit is set.*/
+#define SET_TAG	((uintptr_t)1)
+
+static inline int isRecordSet(const TrieRecord *slot)
+{
+	return ((uintptr_t)slot & SET_TAG) != 0;
+}
+
+static inline RecordSet *recordSet(const TrieRecord *slot)
+{
+	return (RecordSet*)((uintptr_t)slot & ~SET_TAG);
+}
+
+/*the first record of a key, by the slot of the key.*/
+static inline TrieRecord *firstRecord(TrieRecord *slot)
+{
+	return (isRecordSet(slot) ? recordSet(slot)->head : slot);
+}
+
+/*the slot of the payload in the set, or the empty one it would take.*/
+static inline uint32_t findSlot(BurstTrie *bt, const RecordSet *set, const char *payload, 
+		size_t len, uint32_t hash)
+{
+	uint32_t i = hash & set->mask;
+
+	while (set->slots[i].record != NULL && !samePayload(bt, set->slots[i].record, payload, len))
+		i = (i + 1) & set->mask;
+	return i;
+}
+
+static inline RecordSlot *recordSlot(BurstTrie *bt, RecordSet *set, const TrieRecord *record)
+{
+	return &(set->slots[findSlot(bt, set, recordPayload(bt, record), recordLen(bt, record), 
+				recordHash(bt, record))]);
+}
+
+/**
+ * Take the slot i out of the set, and move back the slots behind it
+ * which could not take it, so no probe stops short of its payload.
+ **/
+static void clearSlot(BurstTrie *bt, RecordSet *set, uint32_t i)
+{
+	RecordSlot *slots = set->slots;
+	uint32_t j = i, home;
+
+	slots[i].record = NULL;
+	while (1) {
+		j = (j + 1) & set->mask;
+		if (slots[j].record == NULL)
+			return;
+
+		home = recordHash(bt, slots[j].record) & set->mask;
+		//i is on the probe of slot j.
+		if (((j - home) & set->mask) >= ((j - i) & set->mask)) {
+			slots[i] = slots[j];
+			slots[j].record = NULL;
+			i = j;
+		}
+	}
+}
+
+/**
+ * Point the slot of a key to a new set of its num records linked from
+ * head, a quarter full; or to the link itself if there are too few.
+ * The old set is retired.
+ **/
+static void resetRecordSet(BurstTrie *bt, TrieRecord **record, TrieRecord *head, uint32_t num)
+{
+	RecordSet *set = NULL;
+	RecordSlot *slot = NULL;
+	TrieRecord *ptr, *prev = NULL;
+	uint32_t size = 4;
+
+	if (isRecordSet(*record))
+		epochRetire(&(bt->epoch), recordSet(*record));
+
+	if (num < RECORD_SET_MIN / 2) {
+		*record = head;
+		return;
+	}
+
+	while (size < num * 4)
+		size <<= 1;
+
+	set = (RecordSet*)trieAlloc(bt, sizeof(RecordSet) + size*sizeof(RecordSlot));
+	memset(set->slots, 0, size*sizeof(RecordSlot));
+	set->head = head;
+	set->num = num;
+	set->mask = size - 1;
+
+	for (ptr = head; ptr != NULL; prev = ptr, ptr = ptr->next) {
+		slot = recordSlot(bt, set, ptr);
+		slot->record = ptr;
+		slot->prev = prev;
+	}
+	set->tail = prev;
+
+	*record = (TrieRecord*)((uintptr_t)set | SET_TAG);
+}
+
+/*the record of the payload among the records of a slot, NULL if none.*/
+static TrieRecord *findRecord(BurstTrie *bt, TrieRecord *slot, const char *payload)
+{
+	RecordSet *set = NULL;
+	size_t len = strlen(payload);
+
+	if (isRecordSet(slot)) {
+		set = recordSet(slot);
+		return set->slots[findSlot(bt, set, payload, len, payloadHash(payload, len))].record;
+	}
+
+	while (slot != NULL && !samePayload(bt, slot, payload, len))
+		slot = slot->next;
+	return slot;
+}
+
+/**
+ * Insert a new record to the rear of a record link.
+ * *payload is set to the copy the record holds.
+ * A link of RECORD_SET_MIN records gets a set, the later ones do not walk it.
+ **/
+
+BurstTrieErrCode insertRecordLink(BurstTrie *bt, TrieRecord **record, char **payload)
+{
+	TrieRecord *ptr = *record, *newrecord = NULL;
+	RecordSet *set = NULL;
+	RecordSlot *slot = NULL;
+	size_t len = strlen(*payload);
+	uint32_t num = 1;
+
+	if (isRecordSet(ptr)) {
+		set = recordSet(ptr);
+		slot = &(set->slots[findSlot(bt, set, *payload, len, payloadHash(*payload, len))]);
+		if (slot->record != NULL)
+			return BT_ENTRY_E;
+		ptr = set->tail;
+	}
+	else if (ptr != NULL) {
+		while (ptr->next != NULL && !samePayload(bt, ptr, *payload, len)) {
+			ptr = ptr->next;
+			num ++;
+		}
+
+		if (ptr->next != NULL || samePayload(bt, ptr, *payload, len))
+			return BT_ENTRY_E;
+	}
+
+	newrecord = newRecord(bt, *payload, len);
+	*payload = (char*)recordPayload(bt, newrecord);
+
+	if (*record == NULL)
+		*record = newrecord;
+	else
+		ptr->next = newrecord;
+
+	if (set != NULL) {
+		slot->record = newrecord;
+		slot->prev = ptr;
+		set->tail = newrecord;
+		//grow it at half full.
+		if (++ set->num * 2 > set->mask + 1)
+			resetRecordSet(bt, record, set->head, set->num);
+	}
+	else if (ptr != NULL && num + 1 >= RECORD_SET_MIN)
+		resetRecordSet(bt, record, *record, num + 1);
+
+	return BT_SUCCESS;
+}
+
+/**
+ *	Delete a record form a record link, all of them if payload is NULL;
+ *	*del gets the deleted records, linked.
+ *	A set left with few records, or mostly empty, is made again.
+ **/
+BurstTrieErrCode deleteRecordLink(BurstTrie *bt, TrieRecord **record, char *payload, 
+		TrieRecord **del)
+{
+	TrieRecord *ptr = firstRecord(*record), *pre = NULL;
+	RecordSet *set = NULL;
+	RecordSlot *slot = NULL;
+	size_t len;
+
+	if (ptr == NULL)
+		return BT_ENTRY_NE;
+
+	if (payload == NULL) {
+		//delete all the records!
+		if (isRecordSet(*record))
+			epochRetire(&(bt->epoch), recordSet(*record));
+		*del = ptr;
+		*record = NULL;
+		return BT_SUCCESS;
+	}
+
+	len = strlen(payload);
+	if (isRecordSet(*record)) {
+		set = recordSet(*record);
+		slot = &(set->slots[findSlot(bt, set, payload, len, payloadHash(payload, len))]);
+		if ((ptr = slot->record) == NULL)
+			return BT_ENTRY_NE;
+
+		pre = slot->prev;
+		clearSlot(bt, set, slot - set->slots);
+		//the record behind it is linked from pre now.
+		if (ptr->next != NULL)
+			recordSlot(bt, set, ptr->next)->prev = pre;
+		else
+			set->tail = pre;
+		if (pre == NULL)
+			set->head = ptr->next;
+		set->num --;
+	}
+	else {
+		while (ptr != NULL && !samePayload(bt, ptr, payload, len)) {
+			pre = ptr;
+			ptr = ptr->next;
+		}
+		if (ptr == NULL)
+			return BT_ENTRY_NE;
+		if (pre == NULL)
+			*record = ptr->next;
+	}
+
+	if (pre != NULL)
+		pre->next = ptr->next;
+	ptr->next = NULL;
+	*del = ptr;
+
+	if (set != NULL && (set->num < RECORD_SET_MIN / 2 || set->num * 16 < set->mask + 1))
+		resetRecordSet(bt, record, set->head, set->num);
+
+	return BT_SUCCESS;
+}
+/**
+ * Create a BurstTrie tree, also is the head pointer.
+ * */
+BurstTrieErrCode createBurstTrie(BurstTrie **bt, KeyType type)
+{
+	if ((*bt = (BurstTrie*)malloc(sizeof(BurstTrie))) == NULL)
+		return BT_ERROR;
+		
+	//Init the burst tire tree.
+	(*bt)->type = type;
+	(*bt)->trie_num = 0;
+	(*bt)->pool = NULL;
+
+	switch (type) {
+		case SHORT:
+			(*bt)->max_depth = 3;
+			(*bt)->container_size = INT_CONT_SIZE;
+			(*bt)->tree_width = INT_TREE_WIDTH;
+			break;
+		case INT:
+			(*bt)->max_depth = 7;
+			(*bt)->container_size = INT_CONT_SIZE;
+			(*bt)->tree_width = INT_TREE_WIDTH;
+			break;
+		case VARCHAR:
+			(*bt)->max_depth = MAX_VARCHAR_LEN;
+			(*bt)->container_size = CH_CONT_SIZE;
+			(*bt)->tree_width = CH_TREE_WIDTH;
+			break;
+	}
+
+	pthread_once(&count_once, selectCountLess);
+
+	//give back what is set up already if a step fails.
+	if (initSlab(&((*bt)->slab)) != 0)
+		goto free_bt;
+
+	if (initEpoch(&((*bt)->epoch), trieRelease, &((*bt)->slab)) != 0)
+		goto free_slab;
+
+	int nodeType = CONTAINER;
+	if (initTrieNode(*bt, &((*bt)->root), nodeType, 0, "") != BT_SUCCESS) {
+		destroyBurstTrie(*bt);
+		*bt = NULL;
+		return BT_ERROR;
+	}
+
+	return BT_SUCCESS;
+
+free_slab:
+	destroySlab(&((*bt)->slab));
+free_bt:
+	free(*bt);
+	*bt = NULL;
+	return BT_ERROR;
+}
+
+
+/**
+ * Release a whole BurstTrie at once, block by block;
+ * nobody may be in the trie any more.
+ **/
+void destroyBurstTrie(BurstTrie *bt)
+{
+	EpochThread *thread = NULL;
+	int i;
+
+	for (thread = bt->epoch.threads; thread != NULL; thread = thread->next)
+		free(thread->cache);
+
+	//the shared payloads and the buckets are in the slab.
+	if (bt->pool != NULL) {
+		for (i=0; i<POOL_STRIPES; i++)
+			pthread_mutex_destroy(&(bt->pool->stripes[i].lock));
+		free(bt->pool);
+	}
+
+	destroyEpoch(&(bt->epoch));
+	destroySlab(&(bt->slab));
+	free(bt);
+}
+
+static void countTrieNode(BurstTrie *bt, TrieNode *trie, TrieStats *stats)
+{
+	TrieNode *child = NULL;
+	TrieRecord *rec = NULL;
+	int i, pos;
+
+	switch (trie->type) {
+		case TRIE:
+			if (trie->Term != NULL)
+				stats->keys ++;
+			for (rec = firstRecord(trie->Term); rec != NULL; rec = rec->next)
+				stats->records ++;
+			for (pos = nextChild(bt, trie, 0, &child); pos >= 0;
+					pos = nextChild(bt, trie, pos + 1, &child))
+				countTrieNode(bt, child, stats);
+			break;
+		case CONTAINER:
+			for (i=0; i<trie->size; i++) {
+				if (Records(trie)[i] != NULL)
+					stats->keys ++;
+				for (rec = firstRecord(Records(trie)[i]); rec != NULL; rec = rec->next)
+					stats->records ++;
+			}
+			break;
+	}
+}
+
+/*the payloads in the pool of the trie and the records pointing to them.*/
+static void countPool(BurstTrie *bt, TrieStats *stats)
+{
+	PoolStripe *stripe = NULL;
+	SharedPayload *ptr = NULL;
+	uint32_t i, j;
+
+	for (i=0; i<POOL_STRIPES; i++) {
+		stripe = &(bt->pool->stripes[i]);
+		pthread_mutex_lock(&(stripe->lock));
+		stats->payloads += stripe->num;
+		for (j=0; j<=stripe->mask; j++)
+			for (ptr = stripe->buckets[j]; ptr != NULL; ptr = ptr->next)
+				stats->payload_refs += ptr->refs;
+		pthread_mutex_unlock(&(stripe->lock));
+	}
+}
+
+/**
+ * Count the keys and records of the trie, its shared payloads, and the
+ * memory of its slab. The caller must keep the writers out of the trie.
+ **/
+BurstTrieErrCode getTrieStats(BurstTrie *bt, TrieStats *stats)
+{
+	EpochThread *thread = NULL;
+	SlabCache **caches = NULL;
+	SlabStats slab;
+	int num = 0;
+
+	for (thread = __atomic_load_n(&(bt->epoch.threads), __ATOMIC_ACQUIRE);
+			thread != NULL; thread = thread->next)
+		num ++;
+
+	if ((caches = malloc(sizeof(SlabCache*)*(num+1))) == NULL)
+		return BT_ERROR;
+
+	//a record may get its caches later, then it has allocated nothing yet.
+	num = 0;
+	for (thread = __atomic_load_n(&(bt->epoch.threads), __ATOMIC_ACQUIRE);
+			thread != NULL; thread = thread->next)
+		if (thread->cache != NULL)
+			caches[num ++] = (SlabCache*)thread->cache;
+	caches[num] = NULL;
+
+	slabCount(&(bt->slab), caches, &slab);
+	free(caches);
+
+	memset(stats, 0, sizeof(TrieStats));
+	countTrieNode(bt, bt->root, stats);
+	if (bt->pool != NULL)
+		countPool(bt, stats);
+
+	stats->reserved = slab.reserved;
+	stats->used = slab.used;
+	stats->objects = slab.objects;
+	if (stats->keys > 0)
+		stats->bytes_per_key = (double)slab.reserved / stats->keys;
+
+	return BT_SUCCESS;
+}
+
+/**
+ * Init a new burst trie node, if no memory yet, alloc.
+ * */
+//update 26-03-2009
+//send depth to the function.
+BurstTrieErrCode initTrieNode(BurstTrie *bt, TrieNode **trie, TrieType type, int depth, 
+		const char *path)
+{
+	int size;
+	if ((*trie = (TrieNode*)trieAlloc(bt, sizeof(TrieNode))) == NULL)
+		return BT_ERROR;
+	
+	memset(*trie, 0, sizeof(TrieNode));
+	(*trie)->type = type;
+	
+	switch (type) {
+		case TRIE:
+			//start with the smallest node kind.
+			(*trie)->Kind = NODE4;
+			(*trie)->Node4 = (TrieNode4*)trieAlloc(bt, sizeof(TrieNode4));
+			memset((*trie)->Node4, 0, sizeof(TrieNode4));
+			break;
+		case CONTAINER:
+			size = ((bt->container_size) >> depth);
+			if (size < MIN_CONT)
+				size = MIN_CONT;
+			(*trie)->Keys = newContainer(bt, size, path, depth);
+			(*trie)->MaxSize = size;
+			(*trie)->Stem = keyWidth(bt->type, depth);
+			break;
+	}
+		
+	return BT_SUCCESS;
+}
+
+/**
+ * Get a (Key, Payload) pair from the trie.
+ * If Payload is a null pointer, return all the record with the given key.
+	
+ * And also return the cursor for scanning the trie.
+ **/
+KEY_TYPE_INLINE BurstTrieErrCode getCursorType(BurstTrie *bt, TrieCursor *cursor, Key *key, 
+		const KeyType type)
+ {
+
+#ifdef _FULL_VERSION_
+ 	if (bt == NULL || bt->root == NULL) {
+		perror("Null burst trie pointer! In getCursor.\n");
+		return BT_ERROR;
+	}
+
+	if (type != key->type) {
+	
+		perror("Key type not match! In getCursor.\n");
+		return BT_ERROR;
+	}
+#endif
+	//If there is no element in this burst trie tree.
+	//(a trie node without children may still hold the key "".)
+	if (bt->root->type == CONTAINER && bt->root->size == 0) {
+		cursor->trie = bt->root;
+		cursor->pos = -1;
+		cursor->record = NULL;
+		return BT_END;
+	}
+
+	TrieNode *trie = bt->root, *pretrie = NULL;
+	KeyVal keyval;
+	int depth = 0, pos;
+		
+	setKeyValType(&keyval, key, type);
+
+	while (trie->type == TRIE) {
+		pos = getIndex(depth, keyval, type);
+		depth ++;
+
+		pretrie = trie;
+		trie = findChild(trie, pos);
 		
 		if (trie == NULL) {
 			cursor->pos = pos;
 			cursor->trie = pretrie;
 			cursor->record = NULL;			
+			//The string end: '\0', the key ending at the trie node.
+			if (type == VARCHAR && pos == 0 && pretrie->Term != NULL) {
+				cursor->record = firstRecord(pretrie->Term);
+				return BT_SUCCESS;
+			}
+			return BT_KEY_NF;
+		}
+		
+	}//while
+
+	cursor->trie = trie;
+
+	//The case of the container node. 
+	if (findKey(type, trie, keyval, depth, &pos)) {
+		cursor->pos = pos;
+		cursor->record = firstRecord(Records(trie)[pos]);
+
+		return BT_SUCCESS;
+	}
+
+	//If not found the key: the cursor is on the key before it.
+	cursor->pos = pos - 1;
+	cursor->record = NULL;
+
+	return BT_KEY_NF;
+}
+
+BurstTrieErrCode getCursor(BurstTrie *bt, TrieCursor *cursor, Key *key)
+{
+	SWITCH_KEY_TYPE(bt, getCursorType(bt, cursor, key, type));
+}
+
+/**
+ *	The VARCHAR key ending at the trie node trie: the path to it, which
+ *	is the prefix of its first leaf as long as its depth.
+ **/
+static void termKey(TrieNode *trie, Key *key)
+{
+	int up = 0, len;
+
+	while (trie->type == TRIE) {
+		trie = findChild(trie, trie->Head);
+		up ++;
+	}
+
+	len = strlen(Prefix(trie)) - up;
+	memcpy(&(key->keyval.charkey[0]), Prefix(trie), len);
+	key->keyval.charkey[len] = '\0';
+	key->type = VARCHAR;
+}
+
+/**
+ *	The trie node whose VARCHAR key ends right before the leaf node leaf:
+ *	the highest one on the path to the leaf with a term, below which the
+ *	leaf is the first one; NULL if there is none.
+ **/
+static TrieNode *termBefore(BurstTrie *bt, TrieNode *leaf)
+{
+	TrieNode *trie = bt->root, *term = NULL;
+	const uint8_t *path = (const uint8_t*)Prefix(leaf);
+	int depth;
+
+	for (depth=0; trie->type == TRIE; depth++) {
+		if (term == NULL && trie->Term != NULL)
+			term = trie;
+		if (trie->Head != path[depth])
+			term = NULL;
+		trie = findChild(trie, path[depth]);
+	}
+
+	return term;
+}
+
+/**
+ *	Get the key and record by the given cursor,
+ *	and change the cursor for the next search.
+ **/
+
+KEY_TYPE_INLINE BurstTrieErrCode getNextCursorType(BurstTrie *bt, TrieCursor *cursor, 
+		Key *nextKey, const KeyType type)
+{
+#ifdef _FULL_VERSION_
+	if (bt == NULL || bt->root == NULL || cursor == NULL) {
+		perror("\n");
+		return BT_EEROR;
+	}
+#endif
+	
+	if (cursor->trie == NULL)
+		return BT_END;
+	
+	TrieNode *trie = cursor->trie, *child = NULL, *term = NULL;
+	unsigned int pos = cursor->pos;
+	KeyVal keyval;
+	char buf[MAX_VARCHAR_LEN + 2];
+
+	pos ++;
+
+	if (trie->type != TRIE) {
+		if (pos >= trie->size) {
+			trie = trie->Right;
+			pos = 0;
+			if (trie == NULL)
+				return BT_END;
+			//a key may end between the two leaves.
+			if (type == VARCHAR)
+				term = termBefore(bt, trie);
+		}
+	}	
+	else {
+		//now is the case for trie node.
+		int after = 0;
+		
+		//a scan from the start of a trie node begins with its own key.
+		if (type == VARCHAR && pos == 0 && trie->Term != NULL) {
+			term = trie;
+			goto found;
+		}
+
+		if (trie->size == 0)
+			return BT_END;
+
+		if (trie->Rear >= (int)pos) {
+			nextChild(bt, trie, pos, &child);
+			after = 1;
+		}
+		else {
+			child = findChild(trie, trie->Rear);
+		}
+		trie = child;
+
+		while (trie->type == TRIE) {
+			if (after == 1) {
+				//the key ending at a trie node comes before its children.
+				if (type == VARCHAR && trie->Term != NULL) {
+					term = trie;
+					break;
+				}
+				trie = findChild(trie, trie->Head);
+			}
+			else
+				trie = findChild(trie, trie->Rear);
+		}
+
+		if (after == 0) {
+			trie = trie->Right;
+			if (trie == NULL)
+				return BT_END;
+			if (type == VARCHAR)
+				term = termBefore(bt, trie);
+		}
+
+		pos = 0;
+	} //else
+
+found:
+	if (term != NULL) {
+		termKey(term, nextKey);
+		cursor->record = firstRecord(term->Term);
+		cursor->pos = 0;
+		cursor->trie = term;
+
+		return BT_SUCCESS;
+	}
+	
+	if (type == VARCHAR)
+		keyval.charkey = (char*)contKey(trie->Keys, pos, buf);
+	else
+		keyval.normkey = contIntKey(type, trie, pos);
+	getKeyVal(type, keyval, Prefix(trie), nextKey);
+
+	//update 03-25-2009
+	cursor->record = firstRecord(Records(trie)[pos]);
+	cursor->pos = pos;
+	cursor->trie = trie;
+
+	return BT_SUCCESS;
+
+}
+
+BurstTrieErrCode getNextCursor(BurstTrie *bt, TrieCursor *cursor, Key *nextKey)
+{
+	SWITCH_KEY_TYPE(bt, getNextCursorType(bt, cursor, nextKey, type));
+}
+
+/**
+ *	Get the first payload of a key without any lock.
+ *	Every node read is validated by its version, restart if it changed;
+ *	the payload is copied out, so it is checked once more at the end.
+ **/
+KEY_TYPE_INLINE BurstTrieErrCode getRecordOptimisticType(BurstTrie *bt, Key *key, 
+		char *payload, const KeyType type)
+{
+	TrieNode *trie, *pretrie, node;
+	TrieRecord *record;
+	KeyVal keyval, leaf;
+	uint32_t version, preversion;
+	uint64_t head;
+	char buf[MAX_VARCHAR_LEN + 2];
+	int depth, pos, left, right, mid, retry = 0;
+	int64_t cmp = 0;
+
+	setKeyValType(&keyval, key, type);
+
+restart:
+	backoff(retry ++);
+	depth = 0;
+	trie = bt->root;
+	if (!readLockNode(trie, &version))
+		goto restart;
+
+	while (1) {
+		memcpy(&node, trie, sizeof(TrieNode));
+		if (!checkNode(trie, version))
+			goto restart;
+		if (node.type != TRIE)
+			break;
+
+		pos = getIndex(depth, keyval, type);
+		//the key ends at the trie node.
+		if (type == VARCHAR && pos == 0)
+			break;
+		depth ++;
+
+		pretrie = trie;
+		preversion = version;
+		trie = findChild(&node, pos);
+		if (!checkNode(pretrie, preversion))
+			goto restart;
+		if (trie == NULL)
 			return BT_KEY_NF;
+
+		if (!readLockNode(trie, &version) || !checkNode(pretrie, preversion))
+			goto restart;
+	}
+
+	record = NULL;
+	if (node.type == TRIE) {
+		record = firstRecord(node.Term);
+	}
+	else if (type != VARCHAR) {
+		//the keys read may be torn, the version check below tells.
+		if (findKey(type, &node, keyval, depth, &pos))
+			record = firstRecord(Records(&node)[pos]);
+	}
+	else {
+		left = 0;
+		right = node.size - 1;
+		head = keyHead(keyval.charkey + depth);
+
+		while (left <= right) {
+			mid = (left + right) / 2;
+			cmp = headCmp(head, Heads(&node)[mid]);
+			if (cmp == 0 && headTie(head)) {
+				//the blob must be alive before decode the key.
+				if (!checkNode(trie, version))
+					goto restart;
+				leaf.charkey = (char*)contKey(node.Keys, mid, buf);
+				keyCmp(keyval, leaf, depth, type, &cmp);
+			}
+
+			if (cmp < 0)
+				right = mid - 1;
+			else if (cmp > 0)
+				left = mid + 1;
+			else {
+				record = firstRecord(Records(&node)[mid]);
+				break;
+			}
+		} //while
+	}
+
+	if (!checkNode(trie, version))
+		goto restart;
+	if (record == NULL)
+		return BT_KEY_NF;
+
+	memcpy(payload, recordPayload(bt, record), recordLen(bt, record) + 1);
+	if (!checkNode(trie, version))
+		goto restart;
+
+	return BT_SUCCESS;
+}
+
+BurstTrieErrCode getRecordOptimistic(BurstTrie *bt, Key *key, char *payload)
+{
+	SWITCH_KEY_TYPE(bt, getRecordOptimisticType(bt, key, payload, type));
+}
+
+/**
+ *	Get the smallest key and its first payload without any lock.
+ **/
+BurstTrieErrCode getFirstOptimistic(BurstTrie *bt, Key *key, char *payload)
+{
+	TrieNode *trie, *pretrie, node;
+	TrieRecord *record;
+	KeyVal leaf;
+	uint32_t version, preversion;
+	char path[MAX_VARCHAR_LEN+2];
+	int depth, retry = 0;
+
+restart:
+	backoff(retry ++);
+	depth = 0;
+	trie = bt->root;
+	if (!readLockNode(trie, &version))
+		goto restart;
+
+	while (1) {
+		memcpy(&node, trie, sizeof(TrieNode));
+		if (!checkNode(trie, version))
+			goto restart;
+		if (node.type != TRIE)
+			break;
+
+		//the key ending at the trie node is the smallest one below it.
+		if (node.Term != NULL) {
+			path[depth] = '\0';
+			leaf.charkey = "";
+			record = firstRecord(node.Term);
+			if (!checkNode(trie, version))
+				goto restart;
+			getKeyVal(bt->type, leaf, path, key);
+			memcpy(payload, recordPayload(bt, record), recordLen(bt, record) + 1);
+			if (!checkNode(trie, version))
+				goto restart;
+			return BT_SUCCESS;
+		}
+		path[depth ++] = (char)node.Head;
+
+		pretrie = trie;
+		preversion = version;
+		trie = findChild(&node, node.Head);
+		if (!checkNode(pretrie, preversion))
+			goto restart;
+		if (!readLockNode(trie, &version) || !checkNode(pretrie, preversion))
+			goto restart;
+	}
+
+	if (node.size == 0)
+		return BT_END;
+
+	if (bt->type == VARCHAR)
+		leaf = node.Keys[0];
+	else
+		leaf.normkey = contIntKey(bt->type, &node, 0);
+	record = firstRecord(Records(&node)[0]);
+	if (!checkNode(trie, version))
+		goto restart;
+	//the first key is a restart.
+	if (bt->type == VARCHAR)
+		leaf.charkey ++;
+
+	getKeyVal(bt->type, leaf, Prefix(&node), key);
+	memcpy(payload, recordPayload(bt, record), recordLen(bt, record) + 1);
+
+	if (!checkNode(trie, version))
+		goto restart;
+
+	return BT_SUCCESS;
+}
+
+/**
+ *	Make a new leaf node at depth, a container holding the key.
+ *	A VARCHAR key is given from depth on, path holds the bytes before.
+ *	If record is null, a new record is made for the payload.
+ **/
+static TrieNode *newLeafNode(BurstTrie *bt, int depth, KeyVal keyval,
+		const char *path, TrieRecord *record, char **payload)
+{
+	TrieNode *trie = NULL;
+
+	initTrieNode(bt, &trie, CONTAINER, depth, path);
+	setLeafKey(bt, trie, 0, keyval);
+
+	if (record == NULL) {
+		Records(trie)[0] = NULL;
+		insertRecordLink(bt, &(Records(trie)[0]), payload);
+	}
+	else
+		Records(trie)[0] = record;
+
+	trie->size = 1;
+	packLeaf(bt, trie);
+
+	return trie;
+}
+
+/**
+ *	Find the leaf node beside the position pos of a trie node:
+ *	the first leaf after it (after = 1), or the last one before it.
+ *	The trie node must have another child.
+ **/
+static TrieNode *neighbourLeaf(BurstTrie *bt, TrieNode *trie, int pos, int *after)
+{
+	TrieNode *tmptrie = NULL;
+
+	*after = 0;
+	if (trie->Rear > pos) {
+		nextChild(bt, trie, pos+1, &tmptrie);
+		*after = 1;
+	}
+	else {
+		prevChild(bt, trie, pos-1, &tmptrie);
+	}
+
+	while (tmptrie->type == TRIE) {
+		if (*after == 1)
+			tmptrie = findChild(tmptrie, tmptrie->Head);
+		else
+			tmptrie = findChild(tmptrie, tmptrie->Rear);
+	}
+
+	return tmptrie;
+}
+
+/**
+ *	Link the new leaf node into the double link,
+ *	before the leaf node tmptrie (after = 1), or behind it.
+ **/
+static void linkLeafNode(TrieNode *trie, TrieNode *tmptrie, int after)
+{
+	if (after == 1) {
+		trie->Right = tmptrie;
+		trie->Left = tmptrie->Left;
+		if (tmptrie->Left != NULL)
+			tmptrie->Left->Right = trie;
+		tmptrie->Left = trie;
+	}
+	else {
+		trie->Left = tmptrie;
+		trie->Right = tmptrie->Right;
+		if (tmptrie->Right != NULL)
+			tmptrie->Right->Left = trie;
+		tmptrie->Right = trie;
+	}
+}
+
+/**
+ *	Release a node which has been unlinked from the trie.
+ **/
+static void freeTrieNode(BurstTrie *bt, TrieNode *trie)
+{
+	switch (trie->type) {
+		case TRIE:
+			epochRetire(&(bt->epoch), trie->Index);
+			break;
+		case CONTAINER:
+			epochRetire(&(bt->epoch), trie->Keys);
+			break;
+	}
+	epochRetire(&(bt->epoch), trie);
+}
+
+/**
+ *	Make the trie node trie at depth, which has lost its last child,
+ *	a container again: holding its term if it has one (path has the key),
+ *	linked between the leaves llink and rlink.
+ **/
+static void unburstTrieNode(BurstTrie *bt, TrieNode *trie, int depth, 
+		const char *path, TrieNode *llink, TrieNode *rlink)
+{
+	TrieRecord *term = trie->Term;
+	KeyVal empty;
+	int size = ((bt->container_size) >> depth);
+
+	if (size < MIN_CONT)
+		size = MIN_CONT;
+
+	epochRetire(&(bt->epoch), trie->Index);
+	trie->Keys = newContainer(bt, size, path, depth);
+	trie->MaxSize = size;
+	trie->Stem = keyWidth(bt->type, depth);
+	trie->type = CONTAINER;
+
+	if (term != NULL) {
+		empty.charkey = "";
+		setLeafKey(bt, trie, 0, empty);
+		Records(trie)[0] = term;
+		trie->size = 1;
+		packLeaf(bt, trie);
+	}
+
+	trie->Left = llink;
+	if (llink != NULL)
+		llink->Right = trie;
+	trie->Right = rlink;
+	if (rlink != NULL)
+		rlink->Left = trie;
+}
+
+/**
+ *	Merge the trie node trie at depth back into one container, if its
+ *	children are all containers holding (with its term) no more than
+ *	container_size / UNBURST_RATIO keys together; return 1 if merged.
+ *	Far below the burst point, so a few inserts do not burst it again.
+ *	Nothing is locked on entry; a node already locked by another writer
+ *	leaves the trie node as it is. The children are counted optimistically
+ *	first, and only locked if they may merge.
+ **/
+static int mergeTrieNode(BurstTrie *bt, TrieNode *trie, int depth)
+{
+	TrieNode *children[INT_TREE_WIDTH], *child = NULL, *llink = NULL, *rlink = NULL, node;
+	TrieRecord *term = NULL, *recs[CH_CONT_SIZE + 1];
+	uint32_t version;
+	KeyVal keyval, plain[CH_CONT_SIZE + 1], suffix[CH_CONT_SIZE + 1];
+	char buf[(CH_CONT_SIZE + 1)*(MAX_VARCHAR_LEN + 2)], path[MAX_VARCHAR_LEN + 2];
+	char sbuf[(CH_CONT_SIZE + 1)*(MAX_VARCHAR_LEN + 1)], *key = buf;
+	int limit = bt->container_size / UNBURST_RATIO;
+	int num = 0, total = 0, merged = 0, size, pos, i, j, n;
+
+	//count the keys without a lock first, most trie nodes have too many.
+	if (!readLockNode(trie, &version))
+		return 0;
+	memcpy(&node, trie, sizeof(TrieNode));
+	if (!checkNode(trie, version) || node.type != TRIE || node.size == 0 || node.size > limit)
+		return 0;
+	for (i=0, pos=0; i<node.size && total<=limit; i++, pos++) {
+		pos = nextChild(bt, &node, pos, &child);
+		if (!checkNode(trie, version) || pos < 0)
+			return 0;
+		total += ((child->type == CONTAINER) ? child->size : limit + 1);
+	}
+	if (total > limit || !upgradeNode(trie, version))
+		return 0;
+
+	//the children again, locked.
+	term = ((bt->type == VARCHAR) ? trie->Term : NULL);
+	total = (term != NULL);
+
+	pos = trie->Head;
+	child = findChild(trie, pos);
+	while (1) {
+		if (!tryLockNode(child))
+			goto unlock;
+		children[num ++] = child;
+		if (child->type != CONTAINER || (total += child->size) > limit)
+			goto unlock;
+		if (pos == trie->Rear)
+			break;
+		pos = nextChild(bt, trie, pos+1, &child);
+	}
+
+	llink = children[0]->Left;
+	rlink = children[num-1]->Right;
+	if (llink != NULL && !tryLockNode(llink)) {
+		llink = rlink = NULL;
+		goto unlock;
+	}
+	if (rlink != NULL && !tryLockNode(rlink)) {
+		rlink = NULL;
+		goto unlock;
+	}
+
+	size = ((bt->container_size) >> depth);
+	if (size < MIN_CONT)
+		size = MIN_CONT;
+	if (size < total)
+		size = total;
+
+	//the keys in order: the term, then the children by position.
+	n = 0;
+	if (bt->type == VARCHAR) {
+		memcpy(path, Prefix(children[0]), depth);
+		if (term != NULL) {
+			plain[n].charkey = "";
+			recs[n ++] = term;
+		}
+		for (i=0; i<num; i++) {
+			unpackKeys(children[i]->Keys, children[i]->size, suffix, sbuf);
+			for (j=0; j<children[i]->size; j++, n++) {
+				//one byte longer at the depth of the trie node.
+				key[0] = Prefix(children[i])[depth];
+				strcpy(key + 1, suffix[j].charkey);
+				plain[n].charkey = key;
+				recs[n] = Records(children[i])[j];
+				key += strlen(key) + 1;
+			}
+		}
+	}
+
+	epochRetire(&(bt->epoch), trie->Index);
+	trie->Keys = newContainer(bt, size, path, depth);
+	trie->MaxSize = size;
+	trie->Stem = keyWidth(bt->type, depth);
+	trie->type = CONTAINER;
+
+	if (bt->type == VARCHAR) {
+		for (i=0; i<n; i++) {
+			setLeafKey(bt, trie, i, plain[i]);
+			Records(trie)[i] = recs[i];
+		}
+	}
+	else {
+		for (i=0; i<num; i++) {
+			for (j=0; j<children[i]->size; j++, n++) {
+				keyval.normkey = contIntKey(bt->type, children[i], j);
+				setLeafKey(bt, trie, n, keyval);
+				Records(trie)[n] = Records(children[i])[j];
+			}
+		}
+	}
+	trie->size = n;
+	packLeaf(bt, trie);
+
+	//the container takes the place of the children in the double link.
+	trie->Left = llink;
+	if (llink != NULL)
+		llink->Right = trie;
+	trie->Right = rlink;
+	if (rlink != NULL)
+		rlink->Left = trie;
+
+	for (i=0; i<num; i++) {
+		if (bt->type == VARCHAR && children[i]->size > 0)
+			epochRetire(&(bt->epoch), children[i]->Keys[0].charkey);
+		unlockObsoleteNode(children[i]);
+		freeTrieNode(bt, children[i]);
+	}
+	num = 0;
+	merged = 1;
+
+unlock:
+	for (i=0; i<num; i++)
+		unlockNode(children[i]);
+	if (llink != NULL)
+		unlockNode(llink);
+	if (rlink != NULL)
+		unlockNode(rlink);
+	unlockNode(trie);
+
+	return merged;
+}
+
+/*merge the trie nodes on the path of a delete, from depth up while they merge.*/
+static void mergeTrieNodes(BurstTrie *bt, TrieNode **trie_stack, int depth)
+{
+	while (depth >= 0 && mergeTrieNode(bt, trie_stack[depth], depth))
+		depth --;
+}
+
+/**
+ *	Delete the (Key, payload) pair from the trie.
+ *	if a null payload sended, delete all the record of the Key.
+ *
+ *	The leaf node is locked; if it will be empty, also its parents that
+ *	will be empty, the first one that will not, and its leaf neighbours.
+ **/
+
+KEY_TYPE_INLINE BurstTrieErrCode deleteBurstTrieType(BurstTrie *bt, Key *key, char *payload, 
+		TrieRecord **del, const KeyType type)
+ {
+ #ifdef _FULL_VERSION_
+ 	if (bt == NULL || bt->root == NULL) {
+		perror("\n");
+		return BT_ERROR;
+	}
+#endif
+	if (bt->root->size == 0)
+		return BT_ENTRY_NE;
+
+	*del = NULL;
+
+	TrieNode *trie, *llink, *rlink, node;
+	TrieNode *trie_stack[MAX_VARCHAR_LEN+2];
+	uint32_t version, ver_stack[MAX_VARCHAR_LEN+2];
+	TrieRecord *record = NULL, **head = NULL;
+	KeyVal	keyval;
+	int pos_stack[MAX_VARCHAR_LEN+2];
+	int depth, top, mid, empty, i, retry = 0;
+
+	setKeyValType(&keyval, key, type);
+
+restart:
+	backoff(retry ++);
+	depth = 0;
+	trie = bt->root;
+	if (!readLockNode(trie, &version))
+		goto restart;
+
+	while (1) {
+		memcpy(&node, trie, sizeof(TrieNode));
+		if (!checkNode(trie, version))
+			goto restart;
+		if (node.type != TRIE)
+			break;
+
+		trie_stack[depth] = trie;
+		ver_stack[depth] = version;
+		pos_stack[depth] = getIndex(depth, keyval, type);
+		//the key ends at the trie node.
+		if (type == VARCHAR && pos_stack[depth] == 0)
+			break;
+
+		trie = findChild(&node, pos_stack[depth]);
+		if (!checkNode(trie_stack[depth], ver_stack[depth]))
+			goto restart;
+		if (trie == NULL)
+			return BT_ENTRY_NE;
+
+		if (!readLockNode(trie, &version) ||
+				!checkNode(trie_stack[depth], ver_stack[depth]))
+			goto restart;
+		depth ++;
+	}
+
+	if (!upgradeNode(trie, version))
+		goto restart;
+
+	//find the entry of the key.
+	mid = 0;
+	if (trie->type == TRIE)
+		head = &(trie->Term);
+	else if (findKey(type, trie, keyval, depth, &mid))
+		head = &(Records(trie)[mid]);
+	else
+		head = NULL;
+
+	if (head == NULL || *head == NULL) {
+		unlockNode(trie);
+		return BT_ENTRY_NE;
+	}
+
+	//will the entry be empty?
+	empty = 1;
+	if (payload != NULL) {
+		record = findRecord(bt, *head, payload);
+
+		if (record == NULL) {
+			unlockNode(trie);
+			return BT_ENTRY_NE;
+		}
+		empty = (record == firstRecord(*head) && record->next == NULL);
+	}
+
+	//lock all the nodes to change before changing anything.
+	top = depth;
+	llink = rlink = NULL;
+	if (empty && trie->type != TRIE && trie->size == 1 && depth > 0) {
+		//a trie node with a term stays.
+		do {
+			if (!upgradeNode(trie_stack[top-1], ver_stack[top-1]))
+				goto unlock_restart;
+			top --;
+		} while (top > 0 && trie_stack[top]->size == 1 && 
+				trie_stack[top]->Term == NULL);
+
+		if (trie->Left != NULL) {
+			if (!tryLockNode(trie->Left))
+				goto unlock_restart;
+			llink = trie->Left;
+		}
+		if (trie->Right != NULL) {
+			if (!tryLockNode(trie->Right))
+				goto unlock_restart;
+			rlink = trie->Right;
+		}
+	}
+
+	deleteRecordLink(bt, head, payload, del);
+	if (!empty || trie->type == TRIE) {
+		unlockNode(trie);
+		//the trie node has lost its term.
+		if (empty)
+			mergeTrieNodes(bt, trie_stack, depth);
+		return BT_SUCCESS;
+	}
+
+	//all the records have been deleted.
+	if (type == VARCHAR)
+		recodeKeys(bt, trie, mid, NULL);
+	trie->size --;
+
+	if (trie->type == CONTAINER) {
+		if (type != VARCHAR)
+			moveParts(trie, mid, mid+1, trie->size-mid);
+		memmove(&(Records(trie)[mid]), &(Records(trie)[mid+1]), 
+				(trie->size-mid)*sizeof(TrieRecord*));
+	}
+
+	if (trie->size > 0 || depth == 0) {
+		unlockNode(trie);
+		mergeTrieNodes(bt, trie_stack, depth - 1);
+		return BT_SUCCESS;
+	}
+
+	//update double link!
+	if (llink != NULL)
+		llink->Right = rlink;
+	if (rlink != NULL)
+		rlink->Left = llink;
+	unlockObsoleteNode(trie);
+	freeTrieNode(bt, trie);
+
+	//trace back to delete the parent node if size is 0.
+	while (depth > 0) {
+		depth --;
+		trie = trie_stack[depth];
+
+		//also updates the head & rear, and shrinks the index.
+		removeChild(bt, trie, pos_stack[depth]);
+
+		if (trie->size > 0)
+			break;
+
+		//left with the key ending at it, or the root: a container again.
+		if (trie->Term != NULL || depth == 0) {
+			unburstTrieNode(bt, trie, depth, 
+					((type == VARCHAR) ? keyval.charkey : NULL), llink, rlink);
+			break;
+		}
+
+		unlockObsoleteNode(trie);
+		freeTrieNode(bt, trie);
+	}
+	//the first node left on the path, a trie node may be merged.
+	if (trie->type == CONTAINER)
+		depth --;
+	unlockNode(trie);
+	if (llink != NULL)
+		unlockNode(llink);
+	if (rlink != NULL)
+		unlockNode(rlink);
+
+	mergeTrieNodes(bt, trie_stack, depth);
+
+	return BT_SUCCESS;
+
+unlock_restart:
+	if (llink != NULL)
+		unlockNode(llink);
+	for (i=top; i<depth; i++)
+		unlockNode(trie_stack[i]);
+	unlockNode(trie);
+	goto restart;
+
+ }
+
+BurstTrieErrCode deleteBurstTrie(BurstTrie *bt, Key *key, char *payload, TrieRecord **del)
+{
+	SWITCH_KEY_TYPE(bt, deleteBurstTrieType(bt, key, payload, del, type));
+}
+
+/**
+ * Move a container into keys of exactly its size, the old ones retired.
+ * The blob of a VARCHAR container stays, its keys still point into it;
+ * the depth of such a container is the length of its prefix.
+ **/
+static BurstTrieErrCode compactContainer(BurstTrie *bt, TrieNode *trie)
+{
+	int size = trie->size, width = Width(trie), depth = 0;
+	const char *path = NULL;
+	KeyVal *tmp = trie->Keys, *keys = NULL;
+
+	if (bt->type == VARCHAR) {
+		path = Prefix(trie);
+		depth = strlen(path);
+	}
+	if ((keys = allocContainer(bt, size, width, path, depth)) == NULL)
+		return BT_ERROR;
+
+	memcpy(keys, tmp, width*size);
+	memcpy(contRecords(keys, size, width), Records(trie), sizeof(TrieRecord*)*size);
+	if (bt->type == VARCHAR)
+		memcpy(contHeads(keys, size), Heads(trie), sizeof(uint64_t)*size);
+	trie->Keys = keys;
+	trie->MaxSize = size;
+	epochRetire(&(bt->epoch), tmp);
+
+	return BT_SUCCESS;
+}
+
+/**
+ *	The first leaf under a trie node.
+ **/
+static TrieNode *firstLeaf(TrieNode *trie)
+{
+	while (trie->type == TRIE)
+		trie = findChild(trie, trie->Head);
+	return trie;
+}
+
+/*the leaf a key is in, or one beside where it would be; NULL if there is none.*/
+static TrieNode *findLeaf(BurstTrie *bt, KeyVal keyval)
+{
+	TrieNode *trie = bt->root, *child = NULL;
+	int depth = 0, pos, after;
+
+	while (trie->type == TRIE) {
+		pos = getIndex(depth ++, keyval, bt->type);
+		if ((child = findChild(trie, pos)) == NULL)
+			return ((trie->size > 0) ? neighbourLeaf(bt, trie, pos, &after) : NULL);
+		trie = child;
+	}
+	return trie;
+}
+
+/**
+ * Compact at most num containers along the leaf chain, from the first
+ * leaf or (resume) from the leaf of key: each gets keys of exactly its
+ * size (a root container keeps its size, it never grows). key is set to
+ * the first key of the leaf to resume from; return BT_END at the end of
+ * the chain. The caller keeps the writers out of the trie, and starts a
+ * slice again from key after it let them in; the readers restart on the
+ * versions of the containers.
+ **/
+BurstTrieErrCode compactBurstTrie(BurstTrie *bt, Key *key, int resume, int num)
+{
+	TrieNode *trie = NULL;
+	KeyVal keyval;
+	char buf[MAX_VARCHAR_LEN + 1];
+
+	memset(&keyval, 0, sizeof(KeyVal));
+	if (resume) {
+		setKeyValType(&keyval, key, bt->type);
+		trie = findLeaf(bt, keyval);
+	}
+	else
+		trie = bt->root;
+
+	if (trie != NULL && trie->type == TRIE)
+		trie = firstLeaf(trie);
+
+	for (; trie != NULL && num > 0; trie = trie->Right, num --) {
+		if (trie == bt->root || trie->size == 0 || trie->MaxSize <= trie->size)
+			continue;
+		if (!tryLockNode(trie))
+			continue;
+		if (compactContainer(bt, trie) != BT_SUCCESS) {
+			unlockNode(trie);
+			return BT_ERROR;
+		}
+		unlockNode(trie);
+	}
+
+	if (trie == NULL)
+		return BT_END;
+
+	//a leaf is never empty but the root.
+	if (bt->type == VARCHAR)
+		keyval.charkey = (char*)contKey(trie->Keys, 0, buf);
+	else
+		keyval.normkey = contIntKey(bt->type, trie, 0);
+	getKeyVal(bt->type, keyval, ((bt->type == VARCHAR) ? Prefix(trie) : NULL), key);
+
+	return BT_SUCCESS;
+}
+
+/*the position of a key of a leaf at depth, a VARCHAR one is stored from there.*/
+static inline uint8_t leafIndex(BurstTrie *bt, KeyVal keyval, int depth)
+{
+	return getIndex(((bt->type == VARCHAR) ? 0 : depth), keyval, bt->type);
+}
+
+/**
+ * Move a key of a leaf at depth to a leaf at depth + 1:
+ * a VARCHAR key is one byte shorter there.
+ **/
+static inline void moveKey(BurstTrie *bt, TrieNode *to, int i, KeyVal from)
+{
+	setLeafKey(bt, to, i, leafKey(bt->type, from, 1));
+}
+
+/**
+ *	Burst the full container trie (locked, also its leaf neighbours)
+ *	into a trie node, and insert the key into the new children.
+ *	The new children are not visible before the trie node is unlocked,
+ *	so they are changed without locks.
+ **/
+static BurstTrieErrCode burstContainer(BurstTrie *bt, TrieNode *trie, int depth,
+		KeyVal keyval, char **payload)
+{
+	TrieNode *newnext[INT_TREE_WIDTH], *newtrie, *tmptrie, *llink, *rlink;
+	KeyVal *oldnext, *keys;
+	TrieRecord *record = NULL, **oldrecs;
+	KeyVal *k = NULL;
+	//the INT/SHORT keys rebuilt, or the VARCHAR keys decoded, the new
+	//children refer to them until they are packed. A moved pending key is
+	//copied to the other half of pending than the last one, which a child
+	//may still refer to.
+	KeyVal plain[(INT_CONT_SIZE > CH_CONT_SIZE) ? INT_CONT_SIZE : CH_CONT_SIZE + 1];
+	char buf[(CH_CONT_SIZE + 1)*(MAX_VARCHAR_LEN + 1)];
+	char pending[2][MAX_VARCHAR_LEN + 2];
+	char path[MAX_VARCHAR_LEN+2];
+	int cur = 0;
+	int	max_depth = bt->max_depth,
+		container_size = bt->container_size,
+		tree_width = bt->tree_width;
+	int pos, insert, num, after, i;
+	unsigned int tpos;
+	int64_t cmp = 0;
+
+	//the keys of the leaves are stored from their depth, so is the pending one.
+	keyval = leafKey(bt->type, keyval, depth);
+
+	while (depth <= max_depth && trie->size <= container_size) {
+		oldnext = keys = trie->Keys;
+		oldrecs = Records(trie);
+		memset(newnext, 0, tree_width*sizeof(TrieNode*));
+		keys = plain;
+		if (bt->type == VARCHAR) {
+			memcpy(path, Prefix(trie), depth);
+			unpackKeys(oldnext, trie->size, plain, buf);
 		}
-		
-	}//while
+		else {
+			for (i=0; i<trie->size; i++)
+				plain[i].normkey = contIntKey(bt->type, trie, i);
+		}
+		//the stem is the term of the trie node now.
+		trie->Term = NULL;
 
-	cursor->trie = trie;
-	//The case of the nil node.
-	//The string end: '\0'.
-	if (trie->type == NIL) {
-		cursor->pos = 0;
-		cursor->record = trie->Nil->record;
+		num = 0;
+		newtrie = NULL;
+		llink = trie->Left;
+		rlink = trie->Right;
 
-		return BT_SUCCESS;
-	}
+		//clean the double link.
+		trie->Left = trie->Right = NULL;
 
-	//The case of the container node. 
-	//Binary search.
-	/**
-	left = mid = 0;
-	right = trie->size - 1;
+		insert = 0;
+		//get the position of the insert key
+		pos = leafIndex(bt, keyval, depth);
 
-	
-	while (left <= right) {
-		mid = (left + right) / 2;
-		tmp = &(trie->Cont[mid]);
-		cmp = strcmp(keyval, (tmp->keyval.charkey + depth));
+		for (i=0; i<trie->size; i++) {
 
-		if (cmp < 0)
-			right = mid - 1;
-		else if (cmp > 0)
-			left = mid + 1;
-		else {
-			cursor->pos = mid;
-			cursor->record = tmp->record;
+			k = &(keys[i]);
 
-			return BT_SUCCESS;
-		}
-	} //while
-*/
-	for (i=0; i<trie->size; i++) {
-		tmp = &(trie->Cont[i]);
-		cmp = strcmp(keyval, tmp->keyval.charkey+depth);
-		if (cmp < 0)
-			break;
-		else if (cmp == 0) {
-			cursor->pos = i;
-			cursor->record = tmp->record;
+			tpos = leafIndex(bt, *k, depth);
 
-			return BT_SUCCESS;
-		}
-	}
-	//If not found the key:
-	cursor->pos = --i;
-	cursor->record = NULL;
+			//the key ending here is the term of the trie node.
+			if (tpos == 0 && bt->type == VARCHAR) {
+				trie->Term = oldrecs[i];
+				continue;
+			}
 
-	return BT_KEY_NF;
-}
+			if (newnext[tpos] == NULL) {
+				if (bt->type == VARCHAR)
+					path[depth] = k->charkey[0];
+				//update 26-03-2009, add a new argument.
+				initTrieNode(bt, &newtrie, CONTAINER, depth+1, path);
 
-/**
- *	Get the key and record by the given cursor,
- *	and change the cursor for the next search.
- **/
 
-BurstTrieErrCode getNextCursor(BurstTrie *bt, TrieCursor *cursor, Key *nextKey)
-{
-#ifdef _FULL_VERSION_
-	if (bt == NULL || bt->root == NULL || cursor == NULL) {
-		perror("\n");
-		return BT_EEROR;
-	}
-#endif
-	
-	if (cursor->trie == NULL)
-		return BT_END;
-	
-	TrieNode *trie = cursor->trie, *pretrie = NULL;
-	TrieLeaf *tmp = NULL;
-	unsigned int pos = cursor->pos;
-	int	container_size = bt->container_size,
-		tree_width = bt->tree_width,
-		counter_size = bt->counter_size,
-		counter_unit = tree_width / counter_size;
+				//update the double link.
+				newtrie->Left = llink;
+				if (llink != NULL)
+					llink->Right = newtrie;
+				llink = newtrie;
 
-	pos ++;
+				//update the trie info:
+				newnext[tpos] = newtrie; //!
+				num ++;
 
-	if (trie->type != TRIE) {
-		if (pos >= trie->size) {
-			trie = trie->Right;
-			pos = 0;
-			if (trie == NULL)
-				return BT_END;
-		}
-	}	
-	else {
-		//now is the case for trie node.
-		int i, j, found = 0, after = 0;
-		
-		if (trie->Rear >= pos) {
-			for (i=pos/counter_unit; i<counter_size; i++) {
-				if (trie->Counter[i] > 0) {
-					for (j=i*counter_unit; j<tree_width; j++) {
-						if (trie->Index[j]) {
-							trie = trie->Index[j];
-							found = after = 1;
-							break;
-						}
-					}
+			}
+			else {
+			//if the trie with the same index has been created:
+				newtrie = newnext[tpos];
+			}
 
-					break;
+			//insert & compare and determine if the new entry can be inserted:
+			if (insert == 0 && pos == tpos) {
+				//both are stored from this depth.
+				keyCmp(keyval, *k, 0, bt->type, &cmp);
+
+				if (cmp < 0) {
+					//update 2 lines, 03-27-2009
+					if (newtrie->size >= newtrie->MaxSize)
+						reSizeContainer(bt, newtrie, container_size, depth+1);
+
+					moveKey(bt, newtrie, newtrie->size, keyval);
+					if (record == NULL)
+						insertRecordLink(bt, &(Records(newtrie)[newtrie->size]), payload);
+					else
+						Records(newtrie)[newtrie->size] = record;
+
+					newtrie->size ++;
+
+					insert = 1;
 				}
+			}
 
-			} //for i
-		}
-		else if ((j = trie->Rear) >= 0) {
-			trie = trie->Index[j];
-			found = 1;
+
+			if (newtrie->size < container_size) {
+
+				//update 2 lines, 03-27-2009
+				if (newtrie->size >= newtrie->MaxSize)
+					reSizeContainer(bt, newtrie, container_size, depth+1);
+
+				moveKey(bt, newtrie, newtrie->size, *k);
+				Records(newtrie)[newtrie->size] = oldrecs[i];
+
+				newtrie->size ++;
+			}
+			else {
+				//need to burst again!
+				//exchange the last entry with the insert entry.
+				cpyKeyVal(keyval, *k);
+				record = oldrecs[i];
+				if (bt->type == VARCHAR)
+					keyval.charkey = strcpy(pending[cur ^= 1], k->charkey);
+
+				insert = -1;
+			}
+		}//for
+
+		//update the double link:
+		llink->Right = rlink;
+		if (rlink != NULL)
+			rlink->Left = llink;
+
+		//code the keys of the new children, release the memory.
+		if (bt->type == VARCHAR) {
+			for (i=0; i<tree_width; i++)
+				if (newnext[i] != NULL)
+					packLeaf(bt, newnext[i]);
+			epochRetire(&(bt->epoch), oldnext[0].charkey);
 		}
+		epochRetire(&(bt->epoch), oldnext);
 
-		if (found == 0)
-			return BT_END;
+		//also sets the head & rear of the trie node.
+		buildTrieIndex(bt, trie, newnext, num);
+		trie->type = TRIE;
 
-		while (trie->type == TRIE) {
-			if (after == 1)
-				j = trie->Head;
+		depth ++;
+
+		if (insert == 1)
+			return BT_SUCCESS;
+
+		//the pending key ends at the trie node.
+		if (pos == 0 && bt->type == VARCHAR) {
+			if (record == NULL)
+				insertRecordLink(bt, &(trie->Term), payload);
 			else
-				j = trie->Rear;
+				trie->Term = record;
 
-			trie = trie->Index[j];
+			return BT_SUCCESS;
 		}
 
-		if (after == 0) {
-			trie = trie->Right;
-			if (trie == NULL)
-				return BT_END;
+		//the pending key goes one level down.
+		if (bt->type == VARCHAR) {
+			path[depth-1] = keyval.charkey[0];
+			keyval.charkey = (char*)keySuffix(keyval.charkey, 1);
 		}
 
-		pos = 0;
-	} //else
-	
-	tmp = &(trie->Cont[pos]);
-	if (bt->type == VARCHAR) {
-		strcpy(&(nextKey->keyval.charkey[0]), tmp->keyval.charkey);
-	}
-	else {
-		nextKey->keyval.intkey = tmp->keyval.intkey;
-	}
-	nextKey->type = bt->type;
+		if (insert == -1)//goto next burst loop!
+			trie = newnext[pos];
+		else {
+			if (newnext[pos] == NULL) {
+				//a new leaf node of its own.
+				newtrie = newLeafNode(bt, depth, keyval, path, record, payload);
+				tmptrie = neighbourLeaf(bt, trie, pos, &after);
+				linkLeafNode(newtrie, tmptrie, after);
+				addChild(bt, trie, pos, newtrie);
+
+				return BT_SUCCESS;
+			}
+			else {
+				trie = newnext[pos];
+				if (trie->size < container_size) {
+					//update 2 lines, 03-27-2009
+					if (trie->size >= trie->MaxSize)
+						reSizeContainer(bt, trie, container_size, depth);
 
-	//update 03-25-2009
-	cursor->record = tmp->record;
-	cursor->pos = pos;
-	cursor->trie = trie;
+					if (bt->type == VARCHAR)
+						recodeKeys(bt, trie, trie->size, keyval.charkey);
+					else
+						setLeafKey(bt, trie, trie->size, keyval);
+					//the pending entry may be a moved one, keep its records.
+					if (record == NULL) {
+						Records(trie)[trie->size] = NULL;
+						insertRecordLink(bt, &(Records(trie)[trie->size]), payload);
+					}
+					else
+						Records(trie)[trie->size] = record;
+					trie->size ++;
 
-	return BT_SUCCESS;
+					return BT_SUCCESS;
+				}
+				//else burst again.
+			}
+		}
+
+	}//while
 
+	return BT_ERROR;
 }
 
 /**
- *	Delete the (Key, payload) pair from the trie.
- *	if a null payload sended, delete all the record of the Key.
+ *	Insert the (Key, payload) pair into the trie.
  *
+ *	Only the leaf node is locked, if the key goes into it;
+ *	a new leaf node locks its parent, the leaf beside it and that leaf's
+ *	neighbour on the other side; a burst also locks the leaf neighbours.
  **/
 
- BurstTrieErrCode deleteBurstTrie(BurstTrie *bt, Key *key, char *payload, TrieRecord **del)
- {
- #ifdef _FULL_VERSION_
- 	if (bt == NULL || bt->root == NULL) {
+KEY_TYPE_INLINE BurstTrieErrCode insertBurstTrieType(BurstTrie *bt, Key *key, 
+		char **payload, const KeyType type)
+{
+
+#ifdef _FULL_VERSION_
+	if (bt == NULL || bt->root == NULL) {
 		perror("\n");
 		return BT_ERROR;
 	}
+
 #endif
-	if (bt->root->size == 0)
-		return BT_ENTRY_NE;
-	
-	*del = NULL;
 
-	TrieNode *trie = bt->root, **trie_stack;
-	TrieLeaf *tmp = NULL;
-	TrieRecord *record = NULL;
+	TrieNode *trie, *pretrie, *tmptrie, *adjtrie, *llink, *rlink, node;
+	TrieNode *path[MAX_VARCHAR_LEN+2];
+	uint32_t version, preversion, path_ver[MAX_VARCHAR_LEN+2];
 	KeyVal	keyval;
-	int	max_depth = bt->max_depth,
-		container_size = bt->container_size,
-		tree_width = bt->tree_width,
-		counter_size = bt->counter_size,
-		counter_unit = tree_width / counter_size;
-	unsigned int pos, prepos, *pos_stack;
-	int depth = 0, left, right, mid, i, j, ret;
-	int64_t cmp;
+	int	container_size = bt->container_size;
+	int depth, left, pos, after, n, i, retry = 0;
+	BurstTrieErrCode ret;
+
+	setKeyValType(&keyval, key, type);
+
+restart:
+	backoff(retry ++);
+	depth = 0;
+	trie = bt->root;
+	if (!readLockNode(trie, &version))
+		goto restart;
+
+	while (1) {
+		memcpy(&node, trie, sizeof(TrieNode));
+		if (!checkNode(trie, version))
+			goto restart;
+		if (node.type != TRIE)
+			break;
 
-	setKeyVal(&keyval, key);
+		pos = getIndex(depth, keyval, type);
+		depth ++;
 
-	//alloc the stack space
-	trie_stack = malloc(max_depth*sizeof(TrieNode*));
-	pos_stack = malloc(max_depth*sizeof(unsigned int));
+		pretrie = trie;
+		preversion = version;
+		trie = findChild(&node, pos);
+		if (!checkNode(pretrie, preversion))
+			goto restart;
+
+		if (trie != NULL) {
+			if (!readLockNode(trie, &version) || !checkNode(pretrie, preversion))
+				goto restart;
+			continue;
+		}
 
-	while (trie->type == TRIE) {
-		pos = getIndex(depth, keyval, bt->type);
+		if (!upgradeNode(pretrie, preversion))
+			goto restart;
 
-		trie_stack[depth] = trie;
-		pos_stack[depth] = pos;
-		depth ++;
+		//the key ends at the trie node.
+		if (type == VARCHAR && pos == 0) {
+			ret = insertRecordLink(bt, &(pretrie->Term), payload);
+			unlockNode(pretrie);
+			return ret;
+		}
 
-		trie = trie->Index[pos];
-		if (trie == NULL) {
-			free(trie_stack);
-			free(pos_stack);
-			return BT_ENTRY_NE;
+		//make the new leaf node.
+
+		//find the leaf beside it, the path must not change under us.
+		after = 0;
+		if (pretrie->Rear > pos) {
+			nextChild(bt, pretrie, pos+1, &tmptrie);
+			after = 1;
+		}
+		else {
+			prevChild(bt, pretrie, pos-1, &tmptrie);
 		}
-	}
 
+		for (n=0; ; n++) {
+			if (!readLockNode(tmptrie, &(path_ver[n])))
+				goto unlock_parent;
+			memcpy(&node, tmptrie, sizeof(TrieNode));
+			if (!checkNode(tmptrie, path_ver[n]))
+				goto unlock_parent;
+			path[n] = tmptrie;
+			if (node.type != TRIE)
+				break;
+			tmptrie = findChild(&node, ((after == 1) ? node.Head : node.Rear));
+			if (!checkNode(path[n], path_ver[n]))
+				goto unlock_parent;
+		}
 
-	if (trie->type == NIL) {
-	//if it is the nil node:
-		record = trie->Nil->record;
+		if (!upgradeNode(tmptrie, path_ver[n]))
+			goto unlock_parent;
 
-		if (deleteRecordLink(&record, payload, del) != BT_SUCCESS) {
-			free(trie_stack);
-			free(pos_stack);
-			return BT_ENTRY_NE;
+		adjtrie = ((after == 1) ? tmptrie->Left : tmptrie->Right);
+		if (adjtrie != NULL && !tryLockNode(adjtrie)) {
+			unlockNode(tmptrie);
+			goto unlock_parent;
 		}
-		trie->Nil->record = record;
 
-		if (record != NULL) {
-			free(trie_stack);
-			free(pos_stack);
-			return BT_SUCCESS;
+		for (i=0; i<n; i++) {
+			if (!checkNode(path[i], path_ver[i])) {
+				if (adjtrie != NULL)
+					unlockNode(adjtrie);
+				unlockNode(tmptrie);
+				goto unlock_parent;
+			}
 		}
-		//all the records have been deleted.
-		if (bt->type == VARCHAR)
-			free(trie->Nil->keyval.charkey);
-		trie->size --;
-		
+
+		trie = newLeafNode(bt, depth, leafKey(type, keyval, depth),
+				((type == VARCHAR) ? keyval.charkey : NULL), NULL, payload);
+		linkLeafNode(trie, tmptrie, after);
+		//update the trie node info, the rear & head pointers.
+		addChild(bt, pretrie, pos, trie);
+
+		if (adjtrie != NULL)
+			unlockNode(adjtrie);
+		unlockNode(tmptrie);
+		unlockNode(pretrie);
+
+		return BT_SUCCESS;
+
+unlock_parent:
+		unlockNode(pretrie);
+		goto restart;
+	} //while
+
+	if (!upgradeNode(trie, version))
+		goto restart;
+
+	//The container now:
+	if (findKey(type, trie, keyval, depth, &left)) {
+		ret = insertRecordLink(bt, &(Records(trie)[left]), payload);
+		unlockNode(trie);
+		return ret;
 	}
-	else {
-	//it is a container now.
-	//start binary search
-		left = mid = cmp = 0;
-		right = trie->size - 1;
 
-		while (left <= right) {
-			mid = (left + right) / 2;
-			tmp = &(trie->Cont[mid]);
-			keyCmp(keyval, (tmp->keyval), depth, bt->type, &cmp);
+	//If a burst not happen:
+	if (trie->size < container_size) {
 
-			if (cmp < 0)
-				right = mid - 1;
-			else if (cmp > 0)
-				left = mid + 1;
-			else {
-				if (deleteRecordLink(&(tmp->record), payload, del) != BT_SUCCESS) { 
-					free(trie_stack);
-					free(pos_stack);
-					return BT_ENTRY_E;
-				}
-				
-				if (tmp->record != NULL) {
-					free(trie_stack);
-					free(pos_stack);
-					return BT_SUCCESS;
-				}
+		//update: 03-27-2009
+		//for support new feature.
+		//
+		if (trie->size >= trie->MaxSize)
+			reSizeContainer(bt, trie, container_size, depth);
+
+		//update: 03-24-2009
+
+		// insert at left!
+		if (type == VARCHAR)
+			recodeKeys(bt, trie, left, leafKey(type, keyval, depth).charkey);
+		else {
+			moveParts(trie, left+1, left, trie->size-left);
+			setLeafKey(bt, trie, left, keyval);
+		}
+		memmove(&(Records(trie)[left+1]), &(Records(trie)[left]), 
+				(trie->size-left)*sizeof(TrieRecord*));
+
+		Records(trie)[left] = NULL; //!
+		insertRecordLink(bt, &(Records(trie)[left]), payload);
+
+		trie->size ++;
+		unlockNode(trie);
+		return BT_SUCCESS;
+	}
+
+	//burst will happen now, lock the leaf neighbours.
+	//be careful!
+	llink = trie->Left;
+	rlink = trie->Right;
+	if (llink != NULL && !tryLockNode(llink)) {
+		unlockNode(trie);
+		goto restart;
+	}
+	if (rlink != NULL && !tryLockNode(rlink)) {
+		if (llink != NULL)
+			unlockNode(llink);
+		unlockNode(trie);
+		goto restart;
+	}
+
+	ret = burstContainer(bt, trie, depth, keyval, payload);
+
+	if (rlink != NULL)
+		unlockNode(rlink);
+	if (llink != NULL)
+		unlockNode(llink);
+	unlockNode(trie);
+
+	return ret;
+}
+
+BurstTrieErrCode insertBurstTrie(BurstTrie *bt, Key *key, char **payload)
+{
+	SWITCH_KEY_TYPE(bt, insertBurstTrieType(bt, key, payload, type));
+}
+
+/**
+ *	The order of the loaded records: by key as the trie orders it,
+ *	then as they were given (charkey points into the input).
+ **/
+static int cmpTrieLoad(const void *a, const void *b)
+{
+	const TrieLoad *l1 = (const TrieLoad*)a, *l2 = (const TrieLoad*)b;
+	int cmp = strcmp(l1->keyval.charkey, l2->keyval.charkey);
 
-				if (bt->type == VARCHAR)
-					free(tmp->keyval.charkey);
-
-				trie->size --;
-				
-				if (trie->size > 0) {
-					for (i=mid; i<trie->size; i++) {
-						tmp = &(trie->Cont[i+1]);
-						memcpy(&(trie->Cont[i]), tmp, sizeof(TrieLeaf));
-					}
-				}
-				break;
-			}
-		} //while
-	
-	}// else
+	if (cmp != 0)
+		return cmp;
+	return (l1->keyval.charkey < l2->keyval.charkey ? -1 :
+			(l1->keyval.charkey > l2->keyval.charkey));
+}
 
-	if (*del == NULL) {
-		free(trie_stack);
-		free(pos_stack);
-		return BT_ENTRY_NE;
+/**
+ *	Sort the n items in data, with a scratch of the same size:
+ *	a stable LSD radix sort on the integer keys, skipping the bytes all
+ *	of them share; qsort for the strings.
+ *	Return the one of data and scratch which holds the result.
+ **/
+static TrieLoad *sortItems(BurstTrie *bt, TrieLoad *data, TrieLoad *scratch, size_t n)
+{
+	TrieLoad *from = data, *to = scratch, *swap = NULL;
+	size_t count[256], i, sum, c;
+	uint64_t u;
+	int shift, b;
+
+	if (bt->type == VARCHAR) {
+		qsort(data, n, sizeof(TrieLoad), cmpTrieLoad);
+		return data;
 	}
 
-	//trace back to check delete the parent node if size is 0.
-	while (trie->size == 0 && depth > 0) {
-		//update double link!
-		if (trie->type != TRIE) { //check a bug; trie nodes have no double link! 24-03-2009
-			if (trie->Left != NULL)
-				(trie->Left)->Right = trie->Right;
-			if (trie->Right != NULL)
-				(trie->Right)->Left = trie->Left;
-		}
-		switch (trie->type) {
-			case TRIE:
-				free(trie->Index);
-				break;
-			case CONTAINER:
-				free(trie->Cont);
-				break;
-			case NIL:
-				free(trie->Nil);
-				break;
+	for (shift=0; shift<64; shift+=8) {
+		memset(count, 0, sizeof(count));
+		for (i=0; i<n; i++) {
+			u = from[i].keyval.normkey;
+			count[(u >> shift) & 0xff] ++;
 		}
-		free(trie);
-	
-		depth --;
-		trie = trie_stack[depth];
-		pos = pos_stack[depth];
-
-		trie->size --;
-		trie->Counter[pos/counter_unit] --;
-		trie->Index[pos] = NULL;
 
-		if (trie->size == 0) {
-			//pos = prepos;
+		u = from[0].keyval.normkey;
+		if (count[(u >> shift) & 0xff] == n)
 			continue;
-		}
-			
-		//update the head rear pointers!
-		if (trie->Head == pos) {
-			for (i=pos/counter_unit; i<counter_size; i++) {
-				if (trie->Counter[i] != 0) {
-					for (j=i*counter_unit; j<tree_width; j++)
-						if (trie->Index[j]) {
-							trie->Head = j;
-							break;
-						}
-					break;
-				}
-			}
-		} //if 
-		if (trie->Rear == pos) {
-			for (i=pos/counter_unit; i>=0; i--) {
-				if (trie->Counter[i] != 0) {
-					for (j=(i+1)*counter_unit-1; j>=0; j--)
-						if (trie->Index[j]) {
-							trie->Rear = j;
-							break;
-						}
-					break;
-				}
-			}
-		} //if
 
-	} //while
+		for (b=0, sum=0; b<256; b++) {
+			c = count[b];
+			count[b] = sum;
+			sum += c;
+		}
+		for (i=0; i<n; i++) {
+			u = from[i].keyval.normkey;
+			to[count[(u >> shift) & 0xff] ++] = from[i];
+		}
 
-	if (trie->size == 0) {
-		trie->type = CONTAINER;
-		trie->Left = trie->Right = NULL;
+		swap = from;
+		from = to;
+		to = swap;
 	}
 
-	free(trie_stack);
-	free(pos_stack);
-
-	return BT_SUCCESS;
+	return from;
+}
 
- }
 /**
- *	Insert the (Key, payload) pair into the trie.
- *	
+ *	The first depth at which the keys from min to max take different
+ *	positions, -1 if there is none; all the keys between them share the
+ *	positions above it.
  **/
-
-BurstTrieErrCode insertBurstTrie(BurstTrie *bt, Key *key, char **payload)
+static int splitDepth(BurstTrie *bt, KeyVal min, KeyVal max)
 {
+	int depth;
 
-#ifdef _FULL_VERSION_
-	if (bt == NULL || bt->root == NULL) {
-		perror("\n");
-		return BT_ERROR;
+	for (depth=0; depth<=bt->max_depth; depth++) {
+		if (getIndex(depth, min, bt->type) != getIndex(depth, max, bt->type))
+			return depth;
+		if (bt->type == VARCHAR && min.charkey[depth] == '\0')
+			break;
 	}
 
-#endif
+	return -1;
+}
 
-	TrieNode *trie = bt->root, *pretrie = NULL, *tmptrie = NULL;
-	TrieLeaf *tmp = NULL, pre, current;
-	TrieRecord *record = NULL;
-	TrieType type = CONTAINER;
-	KeyVal	keyval;
-	int	max_depth = bt->max_depth,
-		container_size = bt->container_size,
-		tree_width = bt->tree_width,
-		counter_size = bt->counter_size,
-		counter_unit = tree_width / counter_size;
-	int depth = 0, left, right, mid, pos, insert, i, j;
-	int64_t	cmp = 0;
+/**
+ *	A parallel bulk load: the items are partitioned on their position
+ *	at the split depth, the threads sort and build the partitions.
+ *	Every phase runs on all the threads, a worker takes its share by
+ *	its id, or the next partition from the shared counter.
+ **/
+typedef struct BulkJob {
+	BurstTrie		*bt;
+	TrieLoad		*items;
+	TrieLoad		*tmp;
+	size_t			n;
+	int				threads;
+	int				depth;							//the split depth
+	size_t			(*count)[INT_TREE_WIDTH];		//per thread
+	size_t			start[INT_TREE_WIDTH+1];		//the partitions
+	int				next;
+	TrieNode		*child[INT_TREE_WIDTH];
+	TrieNode		*first[INT_TREE_WIDTH];
+	TrieNode		*last[INT_TREE_WIDTH];
+} BulkJob;
+
+typedef struct BulkWorker {
+	BulkJob			*job;
+	int				id;
+} BulkWorker;
+
+static void runBulkJob(BulkJob *job, void *(*phase)(void*))
+{
+	pthread_t tid[BULK_MAX_THREADS];
+	BulkWorker worker[BULK_MAX_THREADS];
+	int i, n = 1;
+
+	job->next = 0;
+	for (i=0; i<job->threads; i++) {
+		worker[i].job = job;
+		worker[i].id = i;
+	}
 
-	setKeyVal(&keyval, key);
+	//the caller is the worker 0.
+	for (i=1; i<job->threads; i++, n++) {
+		if (pthread_create(&(tid[i]), NULL, phase, &(worker[i])) != 0)
+			break;
+	}
+	//no thread for the rest, do their shares here.
+	for (i=n; i<job->threads; i++)
+		phase(&(worker[i]));
+	phase(&(worker[0]));
 
-	while (trie->type == TRIE) {
-		pos = getIndex(depth, keyval, bt->type);
-		depth ++;
+	for (i=1; i<n; i++)
+		pthread_join(tid[i], NULL);
+}
 
-L00:
-		pretrie = trie;
-		trie = trie->Index[pos];
+static void *countPhase(void *arg)
+{
+	BulkWorker *worker = (BulkWorker*)arg;
+	BulkJob *job = worker->job;
+	size_t i, end = job->n*(worker->id+1)/job->threads;
 
-		//make the new trie node.
-		if (trie == NULL) {
-			if (pos == 0 && bt->type == VARCHAR)
-				type = NIL;
-			else
-				type = CONTAINER;
+	memset(job->count[worker->id], 0, sizeof(job->count[0]));
+	for (i=job->n*worker->id/job->threads; i<end; i++)
+		job->count[worker->id][getIndex(job->depth, job->items[i].keyval, job->bt->type)] ++;
 
-			initTrieNode(bt, &trie, type, depth);
+	return NULL;
+}
 
-			if (type == NIL) {
-				trie->size = 1;//!
+static void *scatterPhase(void *arg)
+{
+	BulkWorker *worker = (BulkWorker*)arg;
+	BulkJob *job = worker->job;
+	size_t i, end = job->n*(worker->id+1)/job->threads, *offset = job->count[worker->id];
 
-				tmp = trie->Nil;
-				tmp->keyval.charkey = malloc(MAX_VARCHAR_LEN*sizeof(char));
-				strcpy(tmp->keyval.charkey, keyval.charkey);
-			}
+	for (i=job->n*worker->id/job->threads; i<end; i++)
+		job->tmp[offset[getIndex(job->depth, job->items[i].keyval, job->bt->type)] ++] = job->items[i];
 
-			//update the double link and insert the new payload.
-			//
-			tmptrie = pretrie;
-			int after = 0;
-			if (tmptrie->Counter[pos/counter_unit] > 0) {
-				for (j=pos+1; j<tree_width; j++) {
-					if (tmptrie->Index[j] != NULL) {
-						tmptrie = tmptrie->Index[j];
-						after = 1;
-						goto L01;
-					}
-				}
-	//			if (after == 1)
-	//				break;
+	return NULL;
+}
 
-				for (j=pos-1; j>=0; j--) {
-					if (tmptrie->Index[j] != NULL) {
-						tmptrie = tmptrie->Index[j];
-						goto L01;
-					}
-				}
-			}
-			//else {
-				//This section has no trie node.
-				//search others..
-				if (tmptrie->Rear > pos) {
-					for (i=(pos/counter_unit)+1; i<counter_size; i++)
-						if (tmptrie->Counter[i] > 0) {
-							for (j=i*counter_unit; j<tree_width; j++)
-								if (tmptrie->Index[j] != NULL) {
-									tmptrie = tmptrie->Index[j];
-									after = 1;
-									goto L01;
-								}
-							break;
-						}
-				}
-				else {
-					for (i=(pos/counter_unit)-1; i>=0; i--)
-						if (tmptrie->Counter[i] > 0) {
-							for (j=(i+1)*counter_unit-1; j>=0; j--)
-								if (tmptrie->Index[j] != NULL) {
-									tmptrie = tmptrie->Index[j];
-									goto L01;
-								}
-							break;
-						}
-				}
+static void *sortPhase(void *arg)
+{
+	BulkJob *job = ((BulkWorker*)arg)->job;
+	TrieLoad *sorted = NULL;
+	size_t s, n;
+	int pos;
+
+	while ((pos = __atomic_fetch_add(&(job->next), 1, __ATOMIC_RELAXED)) < job->bt->tree_width) {
+		s = job->start[pos];
+		if ((n = job->start[pos+1] - s) == 0)
+			continue;
+		sorted = sortItems(job->bt, job->tmp+s, job->items+s, n);
+		if (sorted != job->items+s)
+			memcpy(job->items+s, sorted, n*sizeof(TrieLoad));
+	}
 
-			//}
-			//find the position to uopdate the double link
-L01:
-			while (tmptrie->type == TRIE) {
-				if (after == 1) 
-					j = tmptrie->Head;
-				else   
-					j = tmptrie->Rear;
+	return NULL;
+}
 
-				tmptrie = tmptrie->Index[j];
-			}
+/**
+ *	Sort the items to load by key, unless sorted is set and true.
+ *	With more than one thread, they are partitioned on the first
+ *	position that tells the keys apart and the partitions sorted apart.
+ **/
+BurstTrieErrCode sortTrieLoad(BurstTrie *bt, TrieLoad *items, size_t n, int sorted, int threads)
+{
+	TrieLoad *tmp = NULL, *res = NULL;
+	KeyVal min, max;
+	BulkJob *job = NULL;
+	size_t i, sum;
+	int pos, t;
+
+	//trust the flag only as far as it is true.
+	for (i=1; sorted && i<n; i++) {
+		if (bt->type == VARCHAR)
+			sorted = (cmpTrieLoad(&(items[i-1]), &(items[i])) <= 0);
+		else
+			sorted = (items[i-1].keyval.normkey <= items[i].keyval.normkey);
+	}
+	if (sorted || n < 2)
+		return BT_SUCCESS;
 
-			if (after == 1) {
-				trie->Right = tmptrie;
-				trie->Left = tmptrie->Left;
-				if (tmptrie->Left != NULL)
-					tmptrie->Left->Right = trie;
-				tmptrie->Left = trie;
+	if ((tmp = (TrieLoad*)malloc(n*sizeof(TrieLoad))) == NULL)
+		return BT_ERROR;
 
+	if (threads > BULK_MAX_THREADS)
+		threads = BULK_MAX_THREADS;
+
+	min = max = items[0].keyval;
+	if (threads > 1 && n >= BULK_PARALLEL_MIN) {
+		for (i=1; i<n; i++) {
+			if (bt->type == VARCHAR) {
+				if (strcmp(items[i].keyval.charkey, min.charkey) < 0)
+					min = items[i].keyval;
+				else if (strcmp(items[i].keyval.charkey, max.charkey) > 0)
+					max = items[i].keyval;
 			}
 			else {
-				trie->Left = tmptrie;
-				trie->Right = tmptrie->Right;
-				if (tmptrie->Right != NULL)
-					tmptrie->Right->Left = trie;
-				tmptrie->Right = trie;
-
+				if (items[i].keyval.normkey < min.normkey)
+					min = items[i].keyval;
+				else if (items[i].keyval.normkey > max.normkey)
+					max = items[i].keyval;
 			}
-
-			//update the rear & head pointers.
-			if (pos < pretrie->Head) 
-				pretrie->Head = pos;
-			if (pos > pretrie->Rear)
-				pretrie->Rear = pos;
-			//update the trie node info:
-			pretrie->Index[pos] = trie;
-			pretrie->size ++;
-			pretrie->Counter[ pos/counter_unit ] ++;
 		}
-	} //while
-
-	//If it is a nil node now:
-	if (trie->type == NIL) {
-		tmp = trie->Nil;
-		return insertRecordLink(&(tmp->record), payload);
 	}
-	//The container now:
-	//Binary search:
-	left = mid = 0;
-	cmp = 0;
-	right = trie->size - 1;
-
-	while (left <= right) {
-		mid = (left + right) / 2;
-		tmp = &(trie->Cont[mid]);
-		
-		keyCmp(keyval, (tmp->keyval), depth, bt->type, &cmp);
 
-		if (cmp < 0)
-			right = mid - 1;
-		else if (cmp > 0)
-			left = mid + 1;
-		else 
-			return insertRecordLink(&(tmp->record), payload);
-	} //while
+	if (threads <= 1 || n < BULK_PARALLEL_MIN || splitDepth(bt, min, max) < 0 ||
+			(job = (BulkJob*)malloc(sizeof(BulkJob))) == NULL) {
+		res = sortItems(bt, items, tmp, n);
+		if (res != items)
+			memcpy(items, res, n*sizeof(TrieLoad));
+		free(tmp);
+		return BT_SUCCESS;
+	}
 
-	insert = 0;
-	//If a burst not happen:
-	if (trie->size < container_size) {
+	memset(job, 0, sizeof(BulkJob));
+	job->bt = bt;
+	job->items = items;
+	job->tmp = tmp;
+	job->n = n;
+	job->threads = threads;
+	job->depth = splitDepth(bt, min, max);
+	if ((job->count = malloc(threads*sizeof(job->count[0]))) == NULL) {
+		free(job);
+		free(tmp);
+		return BT_ERROR;
+	}
 
-		//update: 03-27-2009
-		//for support new feature.
-		//
-		if (trie->size >= trie->MaxSize)
-			reSizeContainer(trie, container_size, depth);
+	runBulkJob(job, countPhase);
 
-		//update: 03-24-2009
-		
-		for (i=trie->size; i>left; i--) {
-			memcpy(&(trie->Cont[i]), &(trie->Cont[i-1]), sizeof(TrieLeaf));
-		} //for i
-		// i == left now, insert!
-	
-		tmp = &(trie->Cont[left]);
-		if (bt->type == VARCHAR) {
-			tmp->keyval.charkey = malloc(MAX_VARCHAR_LEN*sizeof(char));
-			strcpy(tmp->keyval.charkey, keyval.charkey);
+	//the offsets of each thread in each partition, in the input order.
+	for (pos=0, sum=0; pos<bt->tree_width; pos++) {
+		job->start[pos] = sum;
+		for (t=0; t<threads; t++) {
+			i = job->count[t][pos];
+			job->count[t][pos] = sum;
+			sum += i;
 		}
-		else {
-			cpyKeyVal(tmp->keyval, keyval);
-		}
-		
-		if (record == NULL) {	//check a smalll bug! 24-03-2009
-			tmp->record = NULL; //!
-			insertRecordLink(&(tmp->record), payload);
-		}
-		else
-			tmp->record = record;
-
-		trie->size ++;
-		return BT_SUCCESS;
 	}
+	job->start[bt->tree_width] = sum;
 
-	//A joke :-)
-	//
-//	return BT_ENTRY_E;
+	runBulkJob(job, scatterPhase);
+	runBulkJob(job, sortPhase);
 
-	//burst will happen now.
-	//be careful!
-	while (depth <= max_depth && trie->size <= container_size) {
-		TrieNode **newnext = malloc(tree_width*sizeof(TrieNode*));
-		TrieLeaf *oldnext = trie->Cont;
-		memset(newnext, 0, tree_width*sizeof(TrieNode*));
-
-		//update 26-03-2009
-		trie->MaxSize = 0;
-		
-		int num = 0;
-		unsigned int tpos;
-		KeyVal *k = NULL;
-		TrieNode *newtrie = NULL, *llink = trie->Left, *rlink = trie->Right;
-
-		//clean the double link.
-		trie->Left = trie->Right = NULL;
+	free(job->count);
+	free(job);
+	free(tmp);
 
-		//init the rear head pointers
-		trie->Head = tree_width;
-		trie->Rear = 0;
+	return BT_SUCCESS;
+}
 
-		insert = 0;
-		//get the position of the insert key
-		pos = getIndex(depth, keyval, bt->type);
-		
-		for (i=0; i<trie->size; i++) {
-			
-			tmp = &(trie->Cont[i]);
-			k = &(tmp->keyval);
+static inline int sameKey(BurstTrie *bt, const TrieLoad *l1, const TrieLoad *l2)
+{
+	if (bt->type == VARCHAR)
+		return strcmp(l1->keyval.charkey, l2->keyval.charkey) == 0;
+	return l1->keyval.normkey == l2->keyval.normkey;
+}
 
-			tpos = getIndex(depth, *k, bt->type);
+/**
+ *	Append the key of items[0] to a leaf at depth, with the payloads
+ *	of the items [0, n) which all have that key; the VARCHAR keys are
+ *	packed when the leaf is full.
+ **/
+/*the records of the payloads of the items [0, n), which all have one key.*/
+static void fillRecords(BurstTrie *bt, TrieRecord **record, TrieLoad *items, size_t n)
+{
+	char *payload;
+	size_t i;
+
+	*record = NULL;
+	for (i=0; i<n; i++) {
+		payload = (char*)items[i].payload;
+		//the same payload twice is stored once.
+		insertRecordLink(bt, record, &payload);
+	}
+}
 
-			if (newnext[tpos] == NULL) {
-				type = ((tpos == 0 && bt->type == VARCHAR) ? NIL : CONTAINER);
-				//update 26-03-2009, add a new argument.
-				initTrieNode(bt, &newtrie, type, depth+1);
+static void fillLeaf(BurstTrie *bt, TrieNode *trie, TrieLoad *items, 
+		size_t n, int depth)
+{
+	fillRecords(bt, &(Records(trie)[trie->size]), items, n);
+	setLeafKey(bt, trie, trie->size ++, leafKey(bt->type, items[0].keyval, depth));
+}
 
-				
-				//update the double link.
-				newtrie->Left = llink;
-				if (llink != NULL)
-					llink->Right = newtrie;
-				llink = newtrie;
+/**
+ *	Make a container of the sorted items [0, n) holding num keys,
+ *	link it behind *last.
+ **/
+static TrieNode *buildLeafNode(BurstTrie *bt, TrieLoad *items, size_t n,
+		int num, int depth, TrieNode **last)
+{
+	TrieNode *trie = (TrieNode*)trieAlloc(bt, sizeof(TrieNode));
+	const char *path = ((bt->type == VARCHAR) ? items[0].keyval.charkey : NULL);
+	size_t i, j;
+	int size;
 
-				//update the head link of the parent trie node:
-				if (trie->Head > tpos)
-					trie->Head = tpos;
+	memset(trie, 0, sizeof(TrieNode));
+	trie->type = CONTAINER;
 
-				//update the trie info:
-				newnext[tpos] = newtrie; //!
-				num ++;
-				trie->Counter[tpos/counter_unit] ++;
-			
-				//update 24-03-2009
-				if (type == NIL) {
-					cpyKeyVal(newtrie->Nil->keyval, *k);
-					memcpy(newtrie->Nil, tmp, sizeof(TrieLeaf));
-					newtrie->size = 1;
+	//just the room of num keys, an insert resizes it later;
+	//but the root container is never resized.
+	size = ((depth == 0) ? bt->container_size : num);
+	if (size < MIN_CONT)
+		size = MIN_CONT;
+	trie->Keys = newContainer(bt, size, path, depth);
+	trie->MaxSize = size;
+	trie->Stem = keyWidth(bt->type, depth);
 
-					continue;
-				}
+	for (i=0; i<n; i=j) {
+		for (j=i+1; j<n && sameKey(bt, &(items[i]), &(items[j])); j++)
+			;
+		fillLeaf(bt, trie, items+i, j-i, depth);
+	}
+	packLeaf(bt, trie);
 
-			}
-			else {
-			//if the trie with the same index has been created:
-				newtrie = newnext[tpos];
-			}
+	trie->Left = *last;
+	if (*last != NULL)
+		(*last)->Right = trie;
+	*last = trie;
 
-			//insert & compare and determine if the new entry can be inserted:
-			if (insert == 0 && pos == tpos) {
-				keyCmp(keyval, *k, depth, bt->type, &cmp);
+	return trie;
+}
 
-				if (cmp < 0) {
-					//update 2 lines, 03-27-2009
-					if (newtrie->size >= newtrie->MaxSize)
-						reSizeContainer(newtrie, container_size, depth+1);
+/**
+ *	Build the subtree of the sorted items [0, n) at depth bottom-up:
+ *	a container if the keys fit in one (as a burst would leave them),
+ *	else a trie node over the subtrees of the positions at depth.
+ *	The leaves are linked in order behind *last.
+ **/
+static TrieNode *buildSubTrie(BurstTrie *bt, TrieLoad *items, size_t n,
+		int depth, TrieNode **last)
+{
+	TrieNode *children[INT_TREE_WIDTH], *trie = NULL;
+	TrieRecord *term = NULL;
+	size_t i, j;
+	int num = 1, pos;
+
+	for (i=1; i<n && (num <= bt->container_size || depth > bt->max_depth); i++) {
+		if (!sameKey(bt, &(items[i-1]), &(items[i])))
+			num ++;
+	}
 
-					TrieLeaf *ptr = &(newtrie->Cont[newtrie->size]);
-					if (bt->type == VARCHAR) {
-						ptr->keyval.charkey = malloc(MAX_VARCHAR_LEN*sizeof(char));
-						strcpy(ptr->keyval.charkey, keyval.charkey);
-					}
-					else {
-						cpyKeyVal(ptr->keyval, keyval);
-					}
-					if (record == NULL)
-						insertRecordLink(&(ptr->record), payload);
-					else
-						ptr->record = record;
+	if (num <= bt->container_size || depth > bt->max_depth)
+		return buildLeafNode(bt, items, n, num, depth, last);
 
-					newtrie->size ++;
+	memset(children, 0, bt->tree_width*sizeof(TrieNode*));
+	num = 0;
 
-					insert = 1;
-				}
-			}
+	for (i=0; i<n; i=j) {
+		pos = getIndex(depth, items[i].keyval, bt->type);
+		for (j=i+1; j<n && getIndex(depth, items[j].keyval, bt->type) == pos; j++)
+			;
 
-			
-			if (newtrie->size < container_size) {
+		//the key ending here is the term of the trie node.
+		if (pos == 0 && bt->type == VARCHAR) {
+			fillRecords(bt, &term, items+i, j-i);
+			continue;
+		}
+		children[pos] = buildSubTrie(bt, items+i, j-i, depth+1, last);
+		num ++;
+	}
 
-				//update 2 lines, 03-27-2009
-				if (newtrie->size >= newtrie->MaxSize)
-					reSizeContainer(newtrie, container_size, depth+1);
+	trie = (TrieNode*)trieAlloc(bt, sizeof(TrieNode));
+	memset(trie, 0, sizeof(TrieNode));
+	buildTrieIndex(bt, trie, children, num);
+	trie->type = TRIE;
+	trie->Term = term;
 
-				cpyKeyVal(newtrie->Cont[newtrie->size].keyval, *k);
-				newtrie->Cont[newtrie->size].record = tmp->record;
+	return trie;
+}
 
-				newtrie->size ++;
-			}
-			else {
-				//need to burst again!
-				//exchange the last entry with the insert entry.
-				cpyKeyVal(keyval, *k);
-				record = tmp->record;
+static void *buildPhase(void *arg)
+{
+	BulkJob *job = ((BulkWorker*)arg)->job;
+	BurstTrie *bt = job->bt;
+	size_t s, n;
+	int pos;
+
+	while ((pos = __atomic_fetch_add(&(job->next), 1, __ATOMIC_RELAXED)) < bt->tree_width) {
+		s = job->start[pos];
+		//the key ending at the split depth is left to the trie node.
+		if ((n = job->start[pos+1] - s) == 0 || (pos == 0 && bt->type == VARCHAR))
+			continue;
+		job->child[pos] = buildSubTrie(bt, job->items+s, n, job->depth+1, &(job->last[pos]));
+		job->first[pos] = firstLeaf(job->child[pos]);
+	}
 
-				insert = -1;
-			}
-		}//for
+	return NULL;
+}
 
-		//update the double link:
-		llink->Right = rlink;
-		if (rlink != NULL)
-			rlink->Left = llink;
+/**
+ *	Build the trie of the sorted items with the threads: the subtrees of
+ *	the positions at the split depth in parallel, then link their leaves
+ *	and make the trie nodes above. NULL if not worth it.
+ **/
+static TrieNode *buildTrieParallel(BurstTrie *bt, TrieLoad *items, size_t n, int threads)
+{
+	TrieNode *children[INT_TREE_WIDTH], *trie = NULL, *last = NULL;
+	BulkJob *job = NULL;
+	size_t i, left, right, mid;
+	int pos, num, depth;
+
+	if (threads > BULK_MAX_THREADS)
+		threads = BULK_MAX_THREADS;
+	if (threads <= 1 || n < BULK_PARALLEL_MIN)
+		return NULL;
+
+	//a container would hold them all.
+	for (i=1, num=1; i<n && num <= bt->container_size; i++) {
+		if (!sameKey(bt, &(items[i-1]), &(items[i])))
+			num ++;
+	}
+	if (num <= bt->container_size)
+		return NULL;
+
+	if ((depth = splitDepth(bt, items[0].keyval, items[n-1].keyval)) < 0 ||
+			(job = (BulkJob*)malloc(sizeof(BulkJob))) == NULL)
+		return NULL;
+
+	memset(job, 0, sizeof(BulkJob));
+	job->bt = bt;
+	job->items = items;
+	job->n = n;
+	job->threads = threads;
+	job->depth = depth;
+
+	//the positions grow with the sorted keys, find where each starts.
+	for (pos=0; pos<=bt->tree_width; pos++) {
+		left = ((pos == 0) ? 0 : job->start[pos-1]);
+		right = n;
+		while (left < right) {
+			mid = (left + right) / 2;
+			if (getIndex(depth, items[mid].keyval, bt->type) < pos)
+				left = mid + 1;
+			else
+				right = mid;
+		}
+		job->start[pos] = left;
+	}
 
-		//update the rear link of the parent trie node:
-		trie->Rear = tpos;
+	runBulkJob(job, buildPhase);
 
-		//release the memory.
-		free(oldnext);
+	num = 0;
+	for (pos=0; pos<bt->tree_width; pos++) {
+		if (job->child[pos] == NULL)
+			continue;
+		job->first[pos]->Left = last;
+		if (last != NULL)
+			last->Right = job->first[pos];
+		last = job->last[pos];
+		num ++;
+	}
 
-		trie->Index = newnext;
+	trie = (TrieNode*)trieAlloc(bt, sizeof(TrieNode));
+	memset(trie, 0, sizeof(TrieNode));
+	buildTrieIndex(bt, trie, job->child, num);
+	trie->type = TRIE;
+	if (bt->type == VARCHAR && job->start[1] > 0)
+		fillRecords(bt, &(trie->Term), items, job->start[1]);
+	free(job);
+
+	//the keys share the positions above the split depth.
+	while (-- depth >= 0) {
+		memset(children, 0, bt->tree_width*sizeof(TrieNode*));
+		children[getIndex(depth, items[0].keyval, bt->type)] = trie;
+		trie = (TrieNode*)trieAlloc(bt, sizeof(TrieNode));
+		memset(trie, 0, sizeof(TrieNode));
+		buildTrieIndex(bt, trie, children, 1);
 		trie->type = TRIE;
-		trie->size = num;
+	}
 
-		depth ++;
+	return trie;
+}
 
-		if (insert == 1) 
-			return BT_SUCCESS;
-		else if (insert == -1)//goto next burst loop!
-			trie = trie->Index[pos];
-		else {
-			if (trie->Index[pos] == NULL)
-				goto L00;
-			else {
-				trie = trie->Index[pos];
-				if (trie->size < container_size) {		
-					//update 2 lines, 03-27-2009
-					if (trie->size >= trie->MaxSize)
-						reSizeContainer(trie, container_size, depth);
+/**
+ *	Load n items sorted by sortTrieLoad() into the trie in one pass.
+ *	An empty trie is built bottom-up (by the threads, if more than one)
+ *	and replaces the root; otherwise the items are inserted one by one,
+ *	in order.
+ *	The caller must keep everybody else out of the trie.
+ **/
+BurstTrieErrCode bulkLoadBurstTrie(BurstTrie *bt, TrieLoad *items, size_t n, int threads)
+{
+	TrieNode *root = bt->root, *trie = NULL, *last = NULL;
+	char *payload;
+	Key key;
+	size_t i;
 
-					tmp = &(trie->Cont[ trie->size ]);
-					if (bt->type == VARCHAR) {
-						tmp->keyval.charkey = malloc(MAX_VARCHAR_LEN*sizeof(char));
-						strcpy((tmp->keyval.charkey), keyval.charkey);
-					}
-					else {
-						cpyKeyVal(tmp->keyval, keyval);
-					}
-					insertRecordLink(&(tmp->record), payload);
-					trie->size ++;
+	if (n == 0)
+		return BT_SUCCESS;
 
-					return BT_SUCCESS;
-				}
-				//else burst again.
-			} 
+	if (root->type != CONTAINER || root->size != 0) {
+		for (i=0; i<n; i++) {
+			getKeyVal(bt->type, items[i].keyval, "", &key);
+			payload = (char*)items[i].payload;
+			if (insertBurstTrie(bt, &key, &payload) == BT_ERROR)
+				return BT_ERROR;
 		}
+		return BT_SUCCESS;
+	}
 
-	}//while
+	if ((trie = buildTrieParallel(bt, items, n, threads)) == NULL)
+		trie = buildSubTrie(bt, items, n, 0, &last);
 
-	return BT_ERROR;
-} 
+	__atomic_store_n(&(bt->root), trie, __ATOMIC_RELEASE);
+	freeTrieNode(bt, root);
+
+	return BT_SUCCESS;
+}
@@ -9,6 +9,51 @@
  *	CHANGES LIST:
  *
  *	DATE				CONTENT
+ *	Oct. 16th			1) Adaptive trie nodes: the index of a TRIE node is
+ *						   one of NODE4/NODE16/NODE48/NODE256, it grows and
+ *						   shrinks with the number of children.
+ *						2) Replace the bucket counters with an occupancy
+ *						   bitmap in NODE48/NODE256.
+ *						3) Add a version word to TrieNode for the optimistic
+ *						   lock coupling, and the lock-free get functions.
+ *						4) Each trie has an Epoch, the unlinked memory is
+ *						   retired to it rather than freed (see epoch.h);
+ *						   _OLC_VERSION_ is on now.
+ *						5) Each trie has a Slab, all its nodes, containers,
+ *						   records, payloads and keys come from it (see slab.h).
+ *						6) sortTrieLoad() and bulkLoadBurstTrie().
+ *						7) Both with threads.
+ *						8) A container keeps its keys in one array and the
+ *						   records in another behind it, a nil node is a
+ *						   container of one; the INT/SHORT keys are searched
+ *						   with SIMD compares (_SIMD_SEARCH_).
+ *						9) KeyVal holds the normalized INT/SHORT key,
+ *						   setKeyVal() is exported for the bulk load.
+ *						10) The prefix of a VARCHAR container behind its
+ *						   records, its keys are stored without it.
+ *						11) A VARCHAR container has the heads of its keys
+ *						   (Heads) between the records and the prefix.
+ *						12) The keys of a VARCHAR container are front coded,
+ *						   in blocks of at most FRONT_RESTART keys.
+ *						13) CH_TREE_WIDTH is the whole byte alphabet, the
+ *						   adaptive nodes keep a sparse VARCHAR node small.
+ *						14) No NIL nodes: a VARCHAR key ending at a trie
+ *						   node is kept by it (term).
+ *						15) An INT/SHORT container only stores the bytes of
+ *						   its keys below its depth, in 8, 4, 2 or 1 bytes;
+ *						   the bytes above and the width are its Stem.
+ *						16) A TrieRecord holds its payload, as long as it is.
+ *						17) A key with RECORD_SET_MIN records or more has a
+ *						   RecordSet, a hash table of its payloads.
+ *						18) A trie may share its payloads (PayloadPool): a
+ *						   payload is stored once and counted, its records
+ *						   point to it (SharedRecord).
+ *						   TrieStats counts them.
+ *						19) A delete merges a trie node whose children hold
+ *						   few keys back into one container (UNBURST_RATIO).
+ *						20) compactBurstTrie() trims the containers along the
+ *						   leaf chain to their sizes, a slice at a time.
+ *
  *	Mar. 27th			1) Change the TrieNode's definition, 
  *						   add a info section to hold the container nodes'
  *						   current max size;
@@ -27,18 +72,72 @@
 
 #define MIN_CONT	1	
 
-#define	INT_CNT_SIZE 16
-#define CH_CNT_SIZE 8
+/**
+ * Define _OLC_VERSION_ to run the non-transactional operations without
+ * the index lock, synchronized by the node versions only.
+ */
+#define _OLC_VERSION_
+
+/**
+ * Define _SIMD_SEARCH_ to count the INT/SHORT keys of a container window
+ * with AVX2/AVX-512 compares, chosen by the CPU at run time.
+ */
+#define _SIMD_SEARCH_
+
+/*the binary search of a container stops at a window of so many keys.*/
+#define SEARCH_WINDOW	32
+
+/*bytes of a VARCHAR key kept in its head, the low byte is its length.*/
+#define HEAD_BYTES		7
+
+/*at most so many front coded VARCHAR keys in a block, the first one shares nothing.*/
+#define FRONT_RESTART	4
+
+/*a key gets a hash table of its payloads at so many records, drops it below the half.*/
+#define RECORD_SET_MIN	32
+
+/*the shared payloads of a trie are split by the top bits of their hashes.*/
+#define POOL_STRIPES	64
+#define POOL_SHIFT		26
+#define POOL_MIN_SIZE	16
+
+/*bits of the node version word, the rest is a counter.*/
+#define OLC_OBSOLETE	1
+#define OLC_LOCKED		2
+
 #define INT_TREE_WIDTH 256
-#define CH_TREE_WIDTH 64
+#define CH_TREE_WIDTH 256
 #define INT_CONT_SIZE 256
 #define CH_CONT_SIZE 12 
 
+/*a delete merges a trie node back into a container at 1/UNBURST_RATIO of the burst point.*/
+#define UNBURST_RATIO	4
+
+/*a bulk load uses the threads for this many records or more, and at most so many threads.*/
+#define BULK_PARALLEL_MIN	65536
+#define BULK_MAX_THREADS	64
+
+/*capacities of the small adaptive trie nodes.*/
+#define NODE4_SIZE	4
+#define NODE16_SIZE	16
+#define NODE48_SIZE	48
+
+/*shrink a little below the capacity of the smaller kind, avoid thrashing.*/
+#define NODE256_MIN	40
+#define NODE48_MIN	12
+#define NODE16_MIN	3
+
+/*words of the child occupancy bitmap, one bit per position.*/
+#define BITMAP_WORDS	(INT_TREE_WIDTH / 64)
+
 #define Index	next.index
-#define Cont	next.cont
-#define Nil		next.nil
+#define Node4	next.node4
+#define Node16	next.node16
+#define Node48	next.node48
+#define Node256	next.node256
+#define Keys	next.keys
 
-#define Counter info.counter
+#define Kind	info.kind
 #define MaxSize	info.max_size
 
 #define Left	ptr0.left
@@ -46,11 +145,33 @@
 #define Head	ptr0.head
 #define	Rear	ptr1.rear
 
+#define Term	ptr2.term
+#define Stem	ptr2.stem
+
+/*bytes of a key stored by a container, the low byte of its stem.*/
+#define Width(trie)	((int)((trie)->Stem & 0xff))
+
+/*the records of a container of size keys are right behind the keys, aligned.*/
+#define contRecords(keys, size, width)	\
+	((TrieRecord**)((char*)(keys) + (((size)*(width) + 7) & ~7)))
+#define Records(trie)	contRecords((trie)->Keys, (trie)->MaxSize, Width(trie))
+
+/*a VARCHAR container has the heads of its keys behind them (see keyHead),*/
+#define contHeads(keys, size)	\
+	((uint64_t*)(contRecords(keys, size, sizeof(KeyVal)) + (size)))
+#define Heads(trie)	contHeads((trie)->Keys, (trie)->MaxSize)
+
+/*and the path to it behind the heads, its key prefix.*/
+#define contPrefix(keys, size)	((char*)(contHeads(keys, size) + (size)))
+#define Prefix(trie)	contPrefix((trie)->Keys, (trie)->MaxSize)
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "server.h"
+#include "epoch.h"
+#include "slab.h"
 
 typedef enum {
 	BT_SUCCESS,
@@ -63,34 +184,127 @@ typedef enum {
 
 typedef enum {
 	TRIE,
-	CONTAINER,
-	NIL
+	CONTAINER
 } TrieType;
 
+/*the layout of a TRIE node's index.*/
+typedef enum {
+	NODE4,
+	NODE16,
+	NODE48,
+	NODE256
+} NodeKind;
+
+/*an INT/SHORT key is kept normalized by setKeyVal(), see there.*/
 typedef union {
-	int64_t	intkey;
-	int32_t	shortkey;
-	char	*charkey;
-	uint8_t units[8];
+	uint64_t	normkey;
+	char		*charkey;
 } KeyVal;
 
+/**
+ * A record and its payload in one allocation from the slab, as long as
+ * the payload: a key reaches its first payload in one step, and a short
+ * payload takes a small size class.
+ */
 typedef struct TrieRecord {
-	char	*payload;
 	struct	TrieRecord *next;
+	uint16_t	len;		//of the payload, without the '\0'
+	char	payload[];
 } TrieRecord;
 
-typedef struct TrieLeaf {
-	KeyVal		keyval;
+/**
+ * The one copy of a payload in a trie sharing them, with the number of
+ * records pointing to it; it is retired with the last of them.
+ */
+typedef struct SharedPayload {
+	struct SharedPayload	*next;	//in its bucket
+	uint32_t	hash;		//payloadHash()
+	uint32_t	refs;
+	uint16_t	len;
+	char		payload[];
+} SharedPayload;
+
+/*the record of a trie sharing its payloads, the next record at the same place.*/
+typedef struct SharedRecord {
+	struct TrieRecord	*next;
+	SharedPayload		*shared;
+} SharedRecord;
+
+/**
+ * The payloads of a trie, each stored once: a chained hash table in
+ * POOL_STRIPES stripes, each with its own lock and grown on its own, so
+ * the inserts of the different keys seldom wait for each other.
+ */
+typedef struct PoolStripe {
+	pthread_mutex_t	lock;
+	SharedPayload	**buckets;
+	uint32_t		mask;		//buckets - 1, a power of 2
+	uint32_t		num;
+} PoolStripe;
+
+typedef struct PayloadPool {
+	PoolStripe	stripes[POOL_STRIPES];
+} PayloadPool;
+
+/**
+ * The records of a key with many of them: the link as it is, and a hash
+ * table of the payloads (linear probing, at most half full), each with
+ * the record before it in the link; an insert or a delete finds the
+ * payload, the tail and the record to unlink from without a walk.
+ * The slot of the key points to the set with the low bit set.
+ */
+typedef struct RecordSlot {
 	TrieRecord	*record;
-} TrieLeaf;
+	TrieRecord	*prev;		//NULL for the head
+} RecordSlot;
+
+typedef struct RecordSet {
+	TrieRecord	*head;
+	TrieRecord	*tail;
+	uint32_t	num;
+	uint32_t	mask;		//slots - 1, a power of 2
+	RecordSlot	slots[];
+} RecordSet;
+
+struct TrieNode;
+
+/**
+ * The adaptive index of a TRIE node.
+ * NODE4/NODE16 keep the used positions sorted in keys[];
+ * NODE48 maps a position to (slot + 1) of child[], 0 for empty;
+ * NODE256 is the plain array, tree_width entries long.
+ * NODE48 and NODE256 also keep a bitmap of the used positions,
+ * so the next/previous child is found without scanning the array.
+ */
+typedef struct TrieNode4 {
+	uint8_t			keys[NODE4_SIZE];
+	struct TrieNode	*child[NODE4_SIZE];
+} TrieNode4;
+
+typedef struct TrieNode16 {
+	uint8_t			keys[NODE16_SIZE];
+	struct TrieNode	*child[NODE16_SIZE];
+} TrieNode16;
+
+typedef struct TrieNode48 {
+	uint64_t		bitmap[BITMAP_WORDS];
+	uint8_t			index[INT_TREE_WIDTH];
+	struct TrieNode	*child[NODE48_SIZE];
+} TrieNode48;
+
+typedef struct TrieNode256 {
+	uint64_t		bitmap[BITMAP_WORDS];
+	struct TrieNode	*child[];
+} TrieNode256;
 
 typedef struct TrieNode {
 	TrieType	type;
 	int			size;
 	union {
-		int8_t	counter[INT_CNT_SIZE];
-		int		max_size; 	
+		NodeKind	kind;
+		int			max_size; 	
 	} info;
+	uint32_t	version;	//OLC_LOCKED | OLC_OBSOLETE | counter
 	union {
 		struct TrieNode 	*left;
 		int			head;
@@ -100,10 +314,17 @@ typedef struct TrieNode {
 		int			rear;
 	} ptr1;
 	union {
-		struct TrieNode	**index;
-		TrieLeaf	*cont;
-		TrieLeaf	*nil;
+		void		*index;
+		TrieNode4	*node4;
+		TrieNode16	*node16;
+		TrieNode48	*node48;
+		TrieNode256	*node256;
+		KeyVal		*keys;		//MaxSize keys, then MaxSize records
 	} next;
+	union {
+		TrieRecord	*term;		//the VARCHAR key ending at a TRIE node
+		uint64_t	stem;		//the key bytes above a container | width
+	} ptr2;
 } TrieNode;
 
 
@@ -112,13 +333,43 @@ typedef struct BurstTrie {
 	KeyType		type;
 	TrieNode	*root;
 	int			max_depth;
-	int			counter_size;
 	int			container_size;
 	int			tree_width;
 	int			trie_num;
+	Epoch		epoch;
+	Slab		slab;
+	PayloadPool	*pool;		//NULL unless the payloads are shared
 } BurstTrie;
 
+/*the payload of a record and its length, wherever it is kept.*/
+#define recordPayload(bt, rec)	\
+	((bt)->pool != NULL ? ((const SharedRecord*)(rec))->shared->payload : (rec)->payload)
+#define recordLen(bt, rec)	\
+	((bt)->pool != NULL ? ((const SharedRecord*)(rec))->shared->len : (rec)->len)
+
+/**
+ * A record to bulk load: the key set by setKeyVal() (a VARCHAR key points
+ * to the caller's string) and the payload.
+ */
+typedef struct TrieLoad {
+	KeyVal		keyval;
+	const char	*payload;
+} TrieLoad;
+
+/*the allocation statistics of a trie.*/
+typedef struct TrieStats {
+	uint64_t	keys;
+	uint64_t	records;
+	uint64_t	reserved;		//bytes of the slab blocks
+	uint64_t	used;			//bytes of the live objects
+	uint64_t	objects;
+	double		bytes_per_key;	//reserved / keys
+	uint64_t	payloads;		//in the PayloadPool, 0 if there is none
+	uint64_t	payload_refs;	//the sum of their refs
+} TrieStats;
+
 
+/*on a TRIE node, pos 0 is the VARCHAR key ending there.*/
 typedef struct {
 	TrieNode		*trie;
 	TrieRecord		*record;
@@ -129,8 +380,39 @@ typedef struct {
 
 //functions list
 
-BurstTrieErrCode initTrieNode(BurstTrie *bt, TrieNode **trie, TrieType type, int depth);
+void setKeyVal(KeyVal *keyval, const Key *key);
+
+BurstTrieErrCode initTrieNode(BurstTrie *bt, TrieNode **trie, TrieType type, int depth, 
+		const char *path);
+
+BurstTrieErrCode createBurstTrie(BurstTrie **bt, KeyType type);
+
+BurstTrieErrCode getCursor(BurstTrie *bt, TrieCursor *cursor, Key *key);
+
+BurstTrieErrCode getNextCursor(BurstTrie *bt, TrieCursor *cursor, Key *nextKey);
+
+BurstTrieErrCode getRecordOptimistic(BurstTrie *bt, Key *key, char *payload);
+
+BurstTrieErrCode getFirstOptimistic(BurstTrie *bt, Key *key, char *payload);
+
+BurstTrieErrCode freeRecordLink(BurstTrie *bt, TrieRecord *record);
+
+void *trieAlloc(BurstTrie *bt, size_t size);
+
+void destroyBurstTrie(BurstTrie *bt);
+
+BurstTrieErrCode getTrieStats(BurstTrie *bt, TrieStats *stats);
+
+BurstTrieErrCode insertBurstTrie(BurstTrie *bt, Key *key, char **payload);
+
+BurstTrieErrCode deleteBurstTrie(BurstTrie *bt, Key *key, char *payload, TrieRecord **del);
+
+BurstTrieErrCode sortTrieLoad(BurstTrie *bt, TrieLoad *items, size_t n, int sorted, int threads);
+
+BurstTrieErrCode bulkLoadBurstTrie(BurstTrie *bt, TrieLoad *items, size_t n, int threads);
+
+BurstTrieErrCode sharePayloadsBurstTrie(BurstTrie *bt);
 
-BurstTrieErrCode getCharKey(BurstTrie *bt, TrieCursor *cursor, Key *key);
+BurstTrieErrCode compactBurstTrie(BurstTrie *bt, Key *key, int resume, int num);
 
 #endif
@@ -0,0 +1,266 @@
+/**
+ *	epoch.c
+ *	Epoch based memory reclamation of the trie.
+ *
+ *	License:	BSD Open Source License.
+ *
+ *	CHANGES LIST:
+ *
+ *	DATE				CONTENT
+ *	Oct. 16th			1) Start
+ *						2) Give the retired pointers back to epoch->release,
+ *						   destroyEpoch() for the bulk release of a trie.
+ *						3) One thread key for all the epochs (epochKey), a
+ *						   thread finds its record by the epoch id in
+ *						   epochCache; all the epochs are linked (epochs).
+ *
+ *	A thread calls epochEnter() before it reads the trie without the index
+ *	lock, and epochExit() when it has done. The memory unlinked from the
+ *	trie is not freed but retired into the limbo bags of the thread, tagged
+ *	with the global epoch. The global epoch only advances when all the
+ *	threads in the trie have seen it, so nobody can still hold a pointer
+ *	retired two epochs ago, and such bags are freed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "epoch.h"
+
+/*the records of the thread by the id of their epoch, the first one tells the thread.*/
+typedef struct EpochSlot {
+	uint64_t	id;
+	EpochThread	*thread;
+} EpochSlot;
+
+static __thread EpochSlot epochCache[EPOCH_CACHE_SIZE];
+
+/*one key for all the epochs, so the number of tries is not bound by the keys.*/
+static pthread_key_t epochKey;
+static pthread_once_t epochOnce = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t epochLock = PTHREAD_MUTEX_INITIALIZER;
+static Epoch *epochs = NULL;
+static uint64_t epochIds = 0;
+
+/**
+ * The thread exits, leave its records (and limbo) to be adopted,
+ * in every epoch it has entered.
+ **/
+static void releaseThread(void *arg)
+{
+	EpochThread *thread = NULL;
+	Epoch *epoch = NULL;
+
+	pthread_mutex_lock(&epochLock);
+	for (epoch = epochs; epoch != NULL; epoch = epoch->link) {
+		for (thread = __atomic_load_n(&(epoch->threads), __ATOMIC_ACQUIRE);
+				thread != NULL; thread = thread->next) {
+			if (__atomic_load_n(&(thread->owner), __ATOMIC_RELAXED) != arg)
+				continue;
+			__atomic_store_n(&(thread->owner), NULL, __ATOMIC_RELAXED);
+			__atomic_store_n(&(thread->local), 0, __ATOMIC_RELEASE);
+			__atomic_store_n(&(thread->used), 0, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&epochLock);
+}
+
+static void initEpochKey(void)
+{
+	pthread_key_create(&epochKey, releaseThread);
+}
+
+int initEpoch(Epoch *epoch, EpochRelease release, void *arg)
+{
+	if (pthread_once(&epochOnce, initEpochKey) != 0)
+		return -1;
+
+	epoch->global = 1;
+	epoch->threads = NULL;
+	epoch->release = release;
+	epoch->arg = arg;
+
+	pthread_mutex_lock(&epochLock);
+	epoch->id = ++ epochIds;
+	epoch->link = epochs;
+	epochs = epoch;
+	pthread_mutex_unlock(&epochLock);
+
+	return 0;
+}
+
+/**
+ * Find the record of the calling thread in the epoch, or register one:
+ * adopt the record of an exited thread, or add a new one.
+ **/
+static EpochThread *registerThread(Epoch *epoch, void *owner)
+{
+	EpochThread *thread = NULL;
+	int used;
+
+	//its own record, out of the cache by another epoch.
+	for (thread = __atomic_load_n(&(epoch->threads), __ATOMIC_ACQUIRE);
+			thread != NULL; thread = thread->next)
+		if (__atomic_load_n(&(thread->owner), __ATOMIC_RELAXED) == owner)
+			return thread;
+
+	//adopt the record of an exited thread.
+	for (thread = __atomic_load_n(&(epoch->threads), __ATOMIC_ACQUIRE);
+			thread != NULL; thread = thread->next) {
+		used = 0;
+		if (__atomic_load_n(&(thread->used), __ATOMIC_RELAXED) == 0 &&
+				__atomic_compare_exchange_n(&(thread->used), &used, 1, 0,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if (thread == NULL) {
+		thread = (EpochThread*)malloc(sizeof(EpochThread));
+		memset(thread, 0, sizeof(EpochThread));
+		thread->used = 1;
+		thread->owner = owner;
+
+		thread->next = __atomic_load_n(&(epoch->threads), __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&(epoch->threads), &(thread->next),
+					thread, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		return thread;
+	}
+
+	__atomic_store_n(&(thread->owner), owner, __ATOMIC_RELAXED);
+	return thread;
+}
+
+/**
+ * Get the record of the calling thread, register it at the first time.
+ **/
+EpochThread *epochThread(Epoch *epoch)
+{
+	EpochSlot *slot = &(epochCache[epoch->id & (EPOCH_CACHE_SIZE - 1)]);
+
+	if (slot->id == epoch->id)
+		return slot->thread;
+
+	//the key only runs releaseThread() when the thread exits.
+	if (pthread_getspecific(epochKey) == NULL)
+		pthread_setspecific(epochKey, epochCache);
+
+	slot->thread = registerThread(epoch, epochCache);
+	slot->id = epoch->id;
+
+	return slot->thread;
+}
+
+EpochThread *epochEnter(Epoch *epoch)
+{
+	EpochThread *thread = epochThread(epoch);
+	uint64_t global = __atomic_load_n(&(epoch->global), __ATOMIC_SEQ_CST);
+
+	__atomic_store_n(&(thread->local), (global << 1) | 1, __ATOMIC_SEQ_CST);
+
+	return thread;
+}
+
+void epochExit(EpochThread *thread)
+{
+	__atomic_store_n(&(thread->local), 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Free the thread records and their limbo bags, but not the retired
+ * pointers: the owner of the epoch releases them in bulk.
+ * No thread may be in the trie.
+ **/
+void destroyEpoch(Epoch *epoch)
+{
+	EpochThread *thread = epoch->threads, *next = NULL;
+	LimboBag *bag = NULL, *tmp = NULL;
+	Epoch **pre = NULL;
+
+	//the exiting threads no longer look at it; its id is never found again.
+	pthread_mutex_lock(&epochLock);
+	for (pre = &epochs; *pre != epoch; pre = &((*pre)->link))
+		;
+	*pre = epoch->link;
+	pthread_mutex_unlock(&epochLock);
+
+	while (thread != NULL) {
+		next = thread->next;
+		bag = thread->limbo;
+		while (bag != NULL) {
+			tmp = bag;
+			bag = bag->next;
+			free(tmp);
+		}
+		free(thread);
+		thread = next;
+	}
+
+	epoch->threads = NULL;
+}
+
+/**
+ * Free ptr when no reader can reach it any more.
+ * Must be called after ptr has been unlinked from the trie.
+ **/
+void epochRetire(Epoch *epoch, void *ptr)
+{
+	EpochThread *thread = epochThread(epoch);
+	LimboBag *bag = thread->limbo;
+	uint64_t global = __atomic_load_n(&(epoch->global), __ATOMIC_SEQ_CST);
+
+	if (bag == NULL || bag->epoch != global || bag->num == EPOCH_BAG_SIZE) {
+		bag = (LimboBag*)malloc(sizeof(LimboBag));
+		bag->epoch = global;
+		bag->num = 0;
+		bag->next = thread->limbo;
+		thread->limbo = bag;
+	}
+	bag->ptr[bag->num ++] = ptr;
+
+	if (++ thread->count >= EPOCH_BATCH) {
+		thread->count = 0;
+		epochReclaim(epoch, thread);
+	}
+}
+
+/**
+ * Try to advance the global epoch, and free the limbo bags of the thread
+ * retired two epochs ago.
+ **/
+void epochReclaim(Epoch *epoch, EpochThread *thread)
+{
+	EpochThread *ptr = NULL;
+	LimboBag *bag = NULL, *tmp = NULL, **pre = NULL;
+	uint64_t global = __atomic_load_n(&(epoch->global), __ATOMIC_SEQ_CST), local;
+	int i;
+
+	for (ptr = __atomic_load_n(&(epoch->threads), __ATOMIC_ACQUIRE);
+			ptr != NULL; ptr = ptr->next) {
+		local = __atomic_load_n(&(ptr->local), __ATOMIC_SEQ_CST);
+		if ((local & 1) != 0 && (local >> 1) != global)
+			break;
+	}
+
+	//if the CAS fails, global gets the new epoch.
+	if (ptr == NULL && __atomic_compare_exchange_n(&(epoch->global), &global,
+				global + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		global ++;
+
+	//the bags are linked from the newest one.
+	pre = &(thread->limbo);
+	while (*pre != NULL && (*pre)->epoch + 2 > global)
+		pre = &((*pre)->next);
+
+	bag = *pre;
+	*pre = NULL;
+
+	while (bag != NULL) {
+		for (i=0; i<bag->num; i++)
+			epoch->release(epoch->arg, thread->cache, bag->ptr[i]);
+		tmp = bag;
+		bag = bag->next;
+		free(tmp);
+	}
+}
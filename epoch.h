@@ -0,0 +1,95 @@
+/**
+ *	epoch.h
+ *	Epoch based memory reclamation of the trie.
+ *
+ *	License:	BSD Open Source License.
+ *
+ *	CHANGES LIST:
+ *
+ *	DATE				CONTENT
+ *	Oct. 16th			1) Start
+ *						2) The retired pointers are given back to a release
+ *						   function (the slab of the trie) instead of free();
+ *						   a thread record also carries the slab caches.
+ *						3) One thread key for all the epochs: a thread keeps
+ *						   its records at hand by the epoch id (EPOCH_CACHE_SIZE).
+ *
+ */
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*number of pointers in a limbo bag.*/
+#define EPOCH_BAG_SIZE	126
+
+/*try to advance the epoch after so many retired pointers.*/
+#define EPOCH_BATCH		256
+
+/*records of a thread kept at hand by the id of their epoch, a power of 2.*/
+#define EPOCH_CACHE_SIZE	64
+
+/**
+ * The pointers retired in the same epoch, freed two epochs later.
+ * The bags of a thread are linked from the newest one.
+ */
+typedef struct LimboBag {
+	uint64_t		epoch;
+	int				num;
+	void			*ptr[EPOCH_BAG_SIZE];
+	struct LimboBag	*next;
+} LimboBag;
+
+/**
+ * The record of a registered thread.
+ * local is (epoch << 1) | 1 while the thread is in the trie, 0 out of it.
+ * The record of an exited thread is not freed, the next new thread
+ * adopts it with its limbo bags.
+ */
+typedef struct EpochThread {
+	uint64_t			local;
+	int					used;
+	int					count;
+	LimboBag			*limbo;
+	void				*cache;	//the slab caches of the thread
+	void				*owner;	//the thread using it, NULL once it exits
+	struct EpochThread	*next;
+} EpochThread;
+
+/*frees a retired pointer, with the slab caches of the calling thread.*/
+typedef void (*EpochRelease)(void *arg, void *cache, void *ptr);
+
+/**
+ * The id of an epoch is never reused, a thread finds its record by it.
+ * All the epochs are linked, a thread releases its records in each of
+ * them when it exits.
+ */
+typedef struct Epoch {
+	uint64_t		global;
+	uint64_t		id;
+	EpochThread		*threads;
+	EpochRelease	release;
+	void			*arg;
+	struct Epoch	*link;
+} Epoch;
+
+
+//functions list
+
+int initEpoch(Epoch *epoch, EpochRelease release, void *arg);
+
+EpochThread *epochThread(Epoch *epoch);
+
+void destroyEpoch(Epoch *epoch);
+
+EpochThread *epochEnter(Epoch *epoch);
+
+void epochExit(EpochThread *thread);
+
+void epochRetire(Epoch *epoch, void *ptr);
+
+void epochReclaim(Epoch *epoch, EpochThread *thread);
+
+#endif
@@ -0,0 +1,410 @@
+/**
+ *	slab.c
+ *	Per-index slab allocator of the trie.
+ *
+ *	License:	BSD Open Source License.
+ *
+ *	CHANGES LIST:
+ *
+ *	DATE				CONTENT
+ *	Oct. 16th			1) Start
+ *						2) freeBlock(): a block whose objects all came
+ *						   back is given back to the system.
+ *
+ *	The nodes, containers, records and payloads of a trie are cut from
+ *	SLAB_BLOCK_SIZE blocks by size classes, so the small objects pay no
+ *	malloc header and the whole trie is given back block by block. A free
+ *	object keeps the next free one in its first word. Each thread caches
+ *	the free objects of every class, only a refill or an overflow of its
+ *	cache takes the lock of the class. The objects given back to the class
+ *	go to the free list of their block, and a block counts the objects out
+ *	of it: once none is out, the block goes back to the system.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+/*objects moved between a thread cache and its class at a time.*/
+#define SLAB_BATCH	(SLAB_CACHE_MAX/2)
+
+static const size_t CLASS_SIZE[SLAB_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 256, 320, 384, 512,
+	768, 1024, 1536, 2048, 3072, 4096, 6144, 8192
+};
+
+/*the class of a size, by 16 bytes step.*/
+static uint8_t CLASS_OF[SLAB_MAX_SIZE/16+1];
+
+static size_t pageSize;
+
+static pthread_once_t classOnce = PTHREAD_ONCE_INIT;
+
+static void initClasses(void)
+{
+	int i, cls = 0;
+
+	for (i=0; i<=SLAB_MAX_SIZE/16; i++) {
+		while (CLASS_SIZE[cls] < (size_t)i*16)
+			cls ++;
+		CLASS_OF[i] = cls;
+	}
+
+	pageSize = sysconf(_SC_PAGESIZE);
+}
+
+static inline SlabBlock *blockOf(void *ptr)
+{
+	return (SlabBlock*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_BLOCK_SIZE-1));
+}
+
+/**
+ * Get an aligned block from the system and link it to the slab.
+ **/
+static SlabBlock *newBlock(Slab *slab, int cls, size_t size)
+{
+	SlabBlock *block = NULL;
+
+	if ((block = aligned_alloc(SLAB_BLOCK_SIZE, size)) == NULL)
+		return NULL;
+
+	memset(block, 0, sizeof(SlabBlock));
+	block->slab = slab;
+	block->cls = cls;
+	block->size = size;
+
+	pthread_mutex_lock(&(slab->lock));
+	block->next = slab->blocks;
+	if (slab->blocks != NULL)
+		slab->blocks->prev = block;
+	slab->blocks = block;
+	slab->reserved += size;
+	pthread_mutex_unlock(&(slab->lock));
+
+	return block;
+}
+
+/**
+ * Unlink the block from the slab and give it back to the system. The pages
+ * past the first are dropped before, the allocator may keep the block.
+ **/
+static void freeBlock(Slab *slab, SlabBlock *block)
+{
+	pthread_mutex_lock(&(slab->lock));
+	if (block->prev != NULL)
+		block->prev->next = block->next;
+	else
+		slab->blocks = block->next;
+	if (block->next != NULL)
+		block->next->prev = block->prev;
+	slab->reserved -= block->size;
+	pthread_mutex_unlock(&(slab->lock));
+
+	madvise((char*)block + pageSize, block->size - pageSize, MADV_DONTNEED);
+	free(block);
+}
+
+int initSlab(Slab *slab)
+{
+	int i;
+
+	pthread_once(&classOnce, initClasses);
+
+	memset(slab, 0, sizeof(Slab));
+	pthread_mutex_init(&(slab->lock), NULL);
+	for (i=0; i<SLAB_CLASSES; i++)
+		pthread_mutex_init(&(slab->cls[i].lock), NULL);
+
+	return 0;
+}
+
+SlabCache *newSlabCaches(void)
+{
+	SlabCache *caches = (SlabCache*)malloc(sizeof(SlabCache)*SLAB_CLASSES);
+
+	if (caches != NULL)
+		memset(caches, 0, sizeof(SlabCache)*SLAB_CLASSES);
+
+	return caches;
+}
+
+/*the list of the blocks of a class with free objects.*/
+static void linkPartial(SlabClass *sc, SlabBlock *block)
+{
+	block->free_prev = NULL;
+	block->free_next = sc->partial;
+	if (sc->partial != NULL)
+		sc->partial->free_prev = block;
+	sc->partial = block;
+}
+
+static void unlinkPartial(SlabClass *sc, SlabBlock *block)
+{
+	if (block->free_prev != NULL)
+		block->free_prev->free_next = block->free_next;
+	else
+		sc->partial = block->free_next;
+	if (block->free_next != NULL)
+		block->free_next->free_prev = block->free_prev;
+}
+
+/**
+ * Take up to max free objects of the class, linked from the returned one;
+ * cut them from the current block when no one is given back.
+ * Called with the lock of the class.
+ **/
+static void *takeObjects(Slab *slab, int cls, int max, int *num)
+{
+	SlabClass *sc = &(slab->cls[cls]);
+	size_t size = CLASS_SIZE[cls];
+	void *head = NULL, **tail = &head;
+	SlabBlock *block = NULL;
+
+	*num = 0;
+	while (sc->partial != NULL && *num < max) {
+		block = sc->partial;
+		while (block->free != NULL && *num < max) {
+			*tail = block->free;
+			block->free = *(void**)block->free;
+			tail = (void**)*tail;
+			block->live ++;
+			(*num) ++;
+		}
+		if (block->free == NULL)
+			unlinkPartial(sc, block);
+	}
+
+	while (*num < max) {
+		if (sc->cur + size > sc->end) {
+			if (*num > 0)
+				break;
+			if ((block = newBlock(slab, cls, SLAB_BLOCK_SIZE)) == NULL)
+				break;
+			sc->block = block;
+			sc->cur = (char*)block + SLAB_HEADER_SIZE;
+			sc->end = (char*)block + SLAB_BLOCK_SIZE;
+		}
+		*tail = sc->cur;
+		tail = (void**)sc->cur;
+		sc->cur += size;
+		sc->block->live ++;
+		(*num) ++;
+	}
+
+	*tail = NULL;
+
+	return head;
+}
+
+/**
+ * Give the objects linked from head back to their blocks, and the blocks
+ * none of whose objects is out any more back to the system, the block
+ * being cut too: the thread caches keep a class from taking and giving
+ * back a block at every object. Called with the lock of the class.
+ **/
+static void putObjects(Slab *slab, int cls, void *head)
+{
+	SlabClass *sc = &(slab->cls[cls]);
+	SlabBlock *block = NULL;
+	void *ptr = NULL;
+
+	while (head != NULL) {
+		ptr = head;
+		head = *(void**)head;
+
+		block = blockOf(ptr);
+		if (block->free == NULL)
+			linkPartial(sc, block);
+		*(void**)ptr = block->free;
+		block->free = ptr;
+
+		if (-- block->live == 0) {
+			if (block == sc->block) {
+				sc->block = NULL;
+				sc->cur = sc->end = NULL;
+			}
+			unlinkPartial(sc, block);
+			freeBlock(slab, block);
+		}
+	}
+}
+
+static void *allocLarge(Slab *slab, size_t size)
+{
+	SlabBlock *block = NULL;
+
+	size = (size + SLAB_HEADER_SIZE + SLAB_BLOCK_SIZE - 1) &
+		~(size_t)(SLAB_BLOCK_SIZE - 1);
+	if ((block = newBlock(slab, -1, size)) == NULL)
+		return NULL;
+
+	__atomic_add_fetch(&(slab->large), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(slab->large_bytes), size, __ATOMIC_RELAXED);
+
+	return (char*)block + SLAB_HEADER_SIZE;
+}
+
+static void freeLarge(Slab *slab, SlabBlock *block)
+{
+	__atomic_sub_fetch(&(slab->large), 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&(slab->large_bytes), block->size, __ATOMIC_RELAXED);
+
+	freeBlock(slab, block);
+}
+
+/**
+ * Allocate size bytes of the slab; caches are the slab caches of the
+ * calling thread, or NULL to go to the class directly.
+ **/
+void *slabAlloc(Slab *slab, SlabCache *caches, size_t size)
+{
+	SlabClass *sc = NULL;
+	SlabCache *cache = NULL;
+	void *ptr = NULL;
+	int cls, num;
+
+	if (size > SLAB_MAX_SIZE)
+		return allocLarge(slab, size);
+
+	cls = CLASS_OF[(size + 15) >> 4];
+	sc = &(slab->cls[cls]);
+
+	if (caches == NULL) {
+		pthread_mutex_lock(&(sc->lock));
+		ptr = takeObjects(slab, cls, 1, &num);
+		if (ptr != NULL)
+			sc->allocs ++;
+		pthread_mutex_unlock(&(sc->lock));
+		return ptr;
+	}
+
+	cache = &(caches[cls]);
+	if (cache->head == NULL) {
+		pthread_mutex_lock(&(sc->lock));
+		cache->head = takeObjects(slab, cls, SLAB_BATCH, &num);
+		pthread_mutex_unlock(&(sc->lock));
+		cache->num = num;
+		if (cache->head == NULL)
+			return NULL;
+	}
+
+	ptr = cache->head;
+	cache->head = *(void**)ptr;
+	cache->num --;
+	__atomic_store_n(&(cache->allocs), cache->allocs + 1, __ATOMIC_RELAXED);
+
+	return ptr;
+}
+
+void slabFree(Slab *slab, SlabCache *caches, void *ptr)
+{
+	SlabBlock *block = NULL;
+	SlabClass *sc = NULL;
+	SlabCache *cache = NULL;
+	void *head = NULL, **tail = NULL;
+	int cls, i;
+
+	if (ptr == NULL)
+		return;
+
+	block = blockOf(ptr);
+	if ((cls = block->cls) < 0) {
+		freeLarge(slab, block);
+		return;
+	}
+	sc = &(slab->cls[cls]);
+
+	if (caches == NULL) {
+		*(void**)ptr = NULL;
+		pthread_mutex_lock(&(sc->lock));
+		putObjects(slab, cls, ptr);
+		sc->frees ++;
+		pthread_mutex_unlock(&(sc->lock));
+		return;
+	}
+
+	cache = &(caches[cls]);
+	*(void**)ptr = cache->head;
+	cache->head = ptr;
+	cache->num ++;
+	__atomic_store_n(&(cache->frees), cache->frees + 1, __ATOMIC_RELAXED);
+
+	if (cache->num < SLAB_CACHE_MAX)
+		return;
+
+	//give the half back to the class.
+	head = cache->head;
+	tail = (void**)head;
+	for (i=1; i<SLAB_BATCH; i++)
+		tail = (void**)*tail;
+	cache->head = *tail;
+	cache->num -= SLAB_BATCH;
+	*tail = NULL;
+
+	pthread_mutex_lock(&(sc->lock));
+	putObjects(slab, cls, head);
+	pthread_mutex_unlock(&(sc->lock));
+}
+
+/**
+ * Sum the counters of the slab and of the given thread caches
+ * (an array of SLAB_CLASSES caches each, NULL terminated).
+ * The numbers are a snapshot, the other threads keep working.
+ **/
+void slabCount(Slab *slab, SlabCache **caches, SlabStats *stats)
+{
+	SlabClass *sc = NULL;
+	int64_t live;
+	int i, j;
+
+	memset(stats, 0, sizeof(SlabStats));
+
+	pthread_mutex_lock(&(slab->lock));
+	stats->reserved = slab->reserved;
+	pthread_mutex_unlock(&(slab->lock));
+
+	for (i=0; i<SLAB_CLASSES; i++) {
+		sc = &(slab->cls[i]);
+		pthread_mutex_lock(&(sc->lock));
+		live = (int64_t)sc->allocs - (int64_t)sc->frees;
+		pthread_mutex_unlock(&(sc->lock));
+
+		for (j=0; caches[j] != NULL; j++)
+			live += (int64_t)__atomic_load_n(&(caches[j][i].allocs), __ATOMIC_RELAXED) -
+				(int64_t)__atomic_load_n(&(caches[j][i].frees), __ATOMIC_RELAXED);
+
+		if (live < 0)
+			live = 0;
+		stats->class_objects[i] = live;
+		stats->objects += live;
+		stats->used += live * CLASS_SIZE[i];
+	}
+
+	stats->objects += __atomic_load_n(&(slab->large), __ATOMIC_RELAXED);
+	stats->used += __atomic_load_n(&(slab->large_bytes), __ATOMIC_RELAXED);
+}
+
+/**
+ * Give all the blocks back to the system at once;
+ * the objects need not be freed one by one.
+ **/
+void destroySlab(Slab *slab)
+{
+	SlabBlock *block = slab->blocks, *next = NULL;
+	int i;
+
+	while (block != NULL) {
+		next = block->next;
+		free(block);
+		block = next;
+	}
+	slab->blocks = NULL;
+	slab->reserved = 0;
+
+	for (i=0; i<SLAB_CLASSES; i++)
+		pthread_mutex_destroy(&(slab->cls[i].lock));
+	pthread_mutex_destroy(&(slab->lock));
+}
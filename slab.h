@@ -0,0 +1,103 @@
+/**
+ *	slab.h
+ *	Per-index slab allocator of the trie.
+ *
+ *	License:	BSD Open Source License.
+ *
+ *	CHANGES LIST:
+ *
+ *	DATE				CONTENT
+ *	Oct. 16th			1) Start
+ *						2) A block counts its objects out and keeps the
+ *						   ones given back, it goes back to the system
+ *						   when they all are.
+ *
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*the blocks are aligned to their size, so an object finds its block.*/
+#define SLAB_BLOCK_SIZE		(64*1024)
+#define SLAB_HEADER_SIZE	64
+
+/*larger objects get a block of their own.*/
+#define SLAB_MAX_SIZE		8192
+#define SLAB_CLASSES		22
+
+/*a thread cache gives the half back when it holds so many objects of a class.*/
+#define SLAB_CACHE_MAX		128
+
+/**
+ * The header of a block, at the start of its first SLAB_HEADER_SIZE bytes.
+ * cls is -1 for the block of a large object.
+ */
+typedef struct SlabBlock {
+	struct Slab			*slab;
+	int					cls;
+	int					live;		//objects out, in use or in a thread cache
+	size_t				size;
+	void				*free;		//the objects given back
+	struct SlabBlock	*prev;		//the blocks of the slab
+	struct SlabBlock	*next;
+	struct SlabBlock	*free_prev;	//the blocks of the class with free objects
+	struct SlabBlock	*free_next;
+} SlabBlock;
+
+/**
+ * The free objects of a class cached by a thread, and its counters;
+ * a thread has SLAB_CLASSES of them.
+ */
+typedef struct SlabCache {
+	void		*head;
+	int			num;
+	uint64_t	allocs;
+	uint64_t	frees;
+} SlabCache;
+
+typedef struct SlabClass {
+	pthread_mutex_t	lock;
+	SlabBlock		*partial;	//the blocks with objects given back
+	SlabBlock		*block;		//the block being cut
+	char			*cur;
+	char			*end;
+	uint64_t		allocs;		//allocs without a thread cache
+	uint64_t		frees;		//frees without a thread cache
+} SlabClass;
+
+typedef struct Slab {
+	SlabClass		cls[SLAB_CLASSES];
+	pthread_mutex_t	lock;		//the block list
+	SlabBlock		*blocks;
+	uint64_t		reserved;	//bytes of all the blocks
+	uint64_t		large;		//live large objects
+	uint64_t		large_bytes;
+} Slab;
+
+typedef struct SlabStats {
+	uint64_t	reserved;		//bytes got from the system
+	uint64_t	used;			//bytes of the live objects, by class size
+	uint64_t	objects;		//live objects
+	uint64_t	class_objects[SLAB_CLASSES];
+} SlabStats;
+
+
+//functions list
+
+int initSlab(Slab *slab);
+
+SlabCache *newSlabCaches(void);
+
+void *slabAlloc(Slab *slab, SlabCache *caches, size_t size);
+
+void slabFree(Slab *slab, SlabCache *caches, void *ptr);
+
+void slabCount(Slab *slab, SlabCache **caches, SlabStats *stats);
+
+void destroySlab(Slab *slab);
+
+#endif
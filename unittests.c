@@ -30,8 +30,11 @@ This is version 1.0, released December 12, 2008.
  */
 
 #include "server.h"
+#include "btimpl.h"
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -309,6 +312,2068 @@ static void *secondary_index_func()
 }
 
 
+/*
+ The decimal digits of v, at least width of them, as the letters 'a' to 'j' into s; the strings
+ keep the order of the numbers of a width.
+ */
+static void spell_number(char *s, int v, int width)
+{
+    sprintf(s, "%0*d", width, v);
+    for (; *s != '\0'; s++) {
+        *s += 'a' - '0';
+    }
+}
+
+/*
+ The key of the number v for an index of the given type; the keys keep the order of the numbers.
+ */
+static void set_key(Key *k, KeyType type, int v)
+{
+    memset(k, 0, sizeof(Key));
+    k->type = type;
+    if (type == SHORT) {
+        k->keyval.shortkey = v * 3 - 100000;
+    } else if (type == INT) {
+        k->keyval.intkey = (int64_t)v * 1000003 - 5000000000LL;
+    } else {
+        strcpy(k->keyval.charkey, "key");
+        spell_number(k->keyval.charkey + 3, v, 7);
+    }
+}
+
+/*
+ The number of a key made by set_key().
+ */
+static int key_number(const Key *k)
+{
+    const char *p;
+    int v = 0;
+
+    if (k->type == SHORT) {
+        return (k->keyval.shortkey + 100000) / 3;
+    } else if (k->type == INT) {
+        return (int)((k->keyval.intkey + 5000000000LL) / 1000003);
+    } else {
+        for (p = k->keyval.charkey + 3; *p != '\0'; p++) {
+            v = v * 10 + (*p - 'a');
+        }
+        return v;
+    }
+}
+
+/*
+ The index and the keys of a test thread, and its result.
+ */
+typedef struct {
+    char *name;
+    KeyType type;
+    int first;
+    int result;
+} ThreadArg;
+
+#define DEADLOCK_MAX 3
+
+//the younger transaction closes the cycle and is the victim itself.
+const int DEADLOCK_OLDER_WAITS[] = {0, 1};
+//the older one closes it, the waiting younger one is woken as the victim.
+const int DEADLOCK_YOUNGER_WAITS[] = {1, 0};
+//the oldest closes a cycle of three, the youngest one waits on it.
+const int DEADLOCK_RING[] = {1, 2, 0};
+
+/*
+ A transaction of the deadlock tests: it writes its key to its first index, then once told to
+ its second one, and commits.
+ */
+typedef struct {
+    char *first;
+    char *second;
+    TxnState *txn;
+    int key;
+    int locked;     //it holds the first index
+    int go;         //it may write the second index
+    int result;     //of the second write, then of the commit
+    int done;
+} DeadlockArg;
+
+/*
+ Runs the transaction of a DeadlockArg, aborts it unless its second write succeeds.
+ */
+static void *deadlock_func(void *arg)
+{
+    DeadlockArg *c = (DeadlockArg*)arg;
+    IdxState *first, *second;
+    Key k;
+
+    c->result = FAILURE;
+    set_key(&k, INT, c->key);
+    if (openIndex(c->first, &first) == SUCCESS && openIndex(c->second, &second) == SUCCESS) {
+        if (insertRecord(first, c->txn, &k, "deadlock") == SUCCESS) {
+            __atomic_store_n(&(c->locked), 1, __ATOMIC_RELEASE);
+            while (!__atomic_load_n(&(c->go), __ATOMIC_ACQUIRE)) {
+                usleep(1000);
+            }
+            c->result = insertRecord(second, c->txn, &k, "deadlock");
+        }
+        if (c->result == SUCCESS) {
+            c->result = commitTransaction(c->txn);
+        } else {
+            abortTransaction(c->txn);
+        }
+        closeIndex(first);
+        closeIndex(second);
+    }
+    __atomic_store_n(&(c->done), 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ Transactions 0 (the oldest) to n - 1 each write index i, then index i + 1 of a ring; the
+ second writes start in the given order, the last one closes a cycle. Only the youngest
+ transaction gets DEADLOCK, either at once or woken while it waits, and its first write is
+ rolled back; the others commit without waiting for any timeout.
+ */
+static int test_deadlock(int n, const int *order)
+{
+    static int tests = 0;
+    char names[DEADLOCK_MAX][32];
+    DeadlockArg args[DEADLOCK_MAX];
+    pthread_t threads[DEADLOCK_MAX];
+    IdxState *idx;
+    Record record;
+    int i, j, done, want;
+
+    tests++;
+    for (i = 0; i < n; i++) {
+        sprintf(names[i], "deadlock_%d_%d", tests, i);
+        if (create(INT, names[i]) != SUCCESS) {
+            printf("could not create %s\n", names[i]);
+            return -1;
+        }
+    }
+    //begun in this order, transaction i is older than i + 1.
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < n; i++) {
+        args[i].first = names[i];
+        args[i].second = names[(i + 1) % n];
+        args[i].key = i;
+        if (beginTransaction(&args[i].txn) != SUCCESS) {
+            return -1;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (pthread_create(&threads[i], NULL, deadlock_func, &args[i]) != 0) {
+            return -1;
+        }
+        while (!__atomic_load_n(&args[i].locked, __ATOMIC_ACQUIRE) &&
+               !__atomic_load_n(&args[i].done, __ATOMIC_ACQUIRE)) {
+            usleep(1000);
+        }
+    }
+    //each second write is waiting before the next one starts.
+    for (i = 0; i < n; i++) {
+        __atomic_store_n(&args[order[i]].go, 1, __ATOMIC_RELEASE);
+        usleep(50000);
+    }
+    for (j = 0, done = 0; j < 2000 && done < n; j++) {
+        for (i = 0, done = 0; i < n; i++) {
+            done += __atomic_load_n(&args[i].done, __ATOMIC_ACQUIRE);
+        }
+        usleep(1000);
+    }
+    if (done < n) {
+        printf("transactions of a deadlock are still waiting\n");
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+        want = i == n - 1 ? DEADLOCK : SUCCESS;
+        if (args[i].result != want) {
+            printf("transaction %d of a deadlock of %d returned %d, not %d\n", i, n,
+                   args[i].result, want);
+            return -1;
+        }
+    }
+
+    //index i holds the key of transaction i and of i - 1, unless that one was the victim.
+    for (i = 0; i < n; i++) {
+        if (openIndex(names[i], &idx) != SUCCESS) {
+            return -1;
+        }
+        for (j = 0; j < 2; j++) {
+            memset(&record, 0, sizeof(Record));
+            set_key(&record.key, INT, (i - j + n) % n);
+            want = (i - j + n) % n == n - 1 ? KEY_NOTFOUND : SUCCESS;
+            if (get(idx, NULL, &record) != want) {
+                printf("the write of transaction %d to %s is%s there\n", (i - j + n) % n,
+                       names[i], want == SUCCESS ? " not" : " still");
+                return -1;
+            }
+        }
+        closeIndex(idx);
+    }
+    return 0;
+}
+
+#define U_LOCK_ROUNDS 200
+
+int U_LOCK_READY = 0;
+int U_LOCK_READ = 0;
+
+/*
+ Reads key 0 of the index in a transaction of its own and sets U_LOCK_READ.
+ */
+static void *u_lock_reader_func(void *arg)
+{
+    IdxState *idx;
+    TxnState *txn;
+    Record record;
+
+    if (openIndex((char*)arg, &idx) != SUCCESS || beginTransaction(&txn) != SUCCESS) {
+        return NULL;
+    }
+    memset(&record, 0, sizeof(Record));
+    set_key(&record.key, INT, 0);
+    if (get(idx, txn, &record) == SUCCESS && commitTransaction(txn) == SUCCESS) {
+        __atomic_store_n(&U_LOCK_READ, 1, __ATOMIC_RELEASE);
+    }
+    closeIndex(idx);
+    return NULL;
+}
+
+/*
+ Reads key 0 then writes a key of its own in a transaction; returns the ErrCode of the first
+ step that fails.
+ */
+static int read_then_write(IdxState *idx, int v)
+{
+    TxnState *txn;
+    Record record;
+    Key k;
+    int errCode;
+
+    if ((errCode = beginTransaction(&txn)) != SUCCESS) {
+        return errCode;
+    }
+    memset(&record, 0, sizeof(Record));
+    set_key(&record.key, INT, 0);
+    set_key(&k, INT, v);
+    if ((errCode = get(idx, txn, &record)) == SUCCESS) {
+        usleep(100);    //long enough for another writer to read as well
+        errCode = insertRecord(idx, txn, &k, "written");
+    }
+    if (errCode != SUCCESS) {
+        abortTransaction(txn);
+        return errCode;
+    }
+    return commitTransaction(txn);
+}
+
+/*
+ Once its handle has read then written, runs U_LOCK_ROUNDS such transactions and counts the
+ deadlocks in result.
+ */
+static void *u_lock_writer_func(void *arg)
+{
+    ThreadArg *c = (ThreadArg*)arg;
+    IdxState *idx;
+    int i, errCode;
+
+    c->result = -1;
+    if (openIndex(c->name, &idx) != SUCCESS) {
+        return NULL;
+    }
+    while ((errCode = read_then_write(idx, c->first)) == DEADLOCK);
+    if (errCode != SUCCESS) {
+        printf("read then write transaction failed -- %d\n", errCode);
+        return NULL;
+    }
+    __atomic_add_fetch(&U_LOCK_READY, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&U_LOCK_READY, __ATOMIC_ACQUIRE) < 2) {
+        sched_yield();
+    }
+    c->result = 0;
+    for (i = 1; i <= U_LOCK_ROUNDS; i++) {
+        errCode = read_then_write(idx, c->first + 2 * i);
+        if (errCode == DEADLOCK) {
+            c->result++;
+        } else if (errCode != SUCCESS) {
+            printf("read then write transaction failed -- %d\n", errCode);
+            c->result = -1;
+            break;
+        }
+    }
+    closeIndex(idx);
+    return NULL;
+}
+
+/*
+ A handle whose last transaction read then wrote reads in U mode: other readers still get in,
+ and two such handles reading then writing at once wait for each other instead of deadlocking.
+ */
+static int test_u_lock(char *name)
+{
+    ThreadArg writers[2];
+    pthread_t reader_thread, writer_threads[2];
+    IdxState *idx;
+    TxnState *txn;
+    Record record;
+    Key k;
+    int i;
+
+    if (create(INT, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create %s\n", name);
+        return -1;
+    }
+    set_key(&k, INT, 0);
+    if (insertRecord(idx, NULL, &k, "zero") != SUCCESS || read_then_write(idx, 1) != SUCCESS) {
+        return -1;
+    }
+
+    //this read takes U, a reader of another handle gets in.
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    record.key = k;
+    if (get(idx, txn, &record) != SUCCESS) {
+        return -1;
+    }
+    U_LOCK_READ = 0;
+    if (pthread_create(&reader_thread, NULL, u_lock_reader_func, name) != 0) {
+        return -1;
+    }
+    for (i = 0; i < 200 && !__atomic_load_n(&U_LOCK_READ, __ATOMIC_ACQUIRE); i++) {
+        usleep(10000);
+    }
+    set_key(&k, INT, 3);
+    if (!U_LOCK_READ || insertRecord(idx, txn, &k, "written") != SUCCESS ||
+        commitTransaction(txn) != SUCCESS) {
+        printf("a reader could not read beside the U lock\n");
+        return -1;
+    }
+    pthread_join(reader_thread, NULL);
+
+    for (i = 0; i < 2; i++) {
+        writers[i].name = name;
+        writers[i].first = 10 + i;
+        if (pthread_create(&writer_threads[i], NULL, u_lock_writer_func, &writers[i]) != 0) {
+            return -1;
+        }
+    }
+    pthread_join(writer_threads[0], NULL);
+    pthread_join(writer_threads[1], NULL);
+    if (writers[0].result != 0 || writers[1].result != 0) {
+        printf("read then write transactions deadlocked %d and %d times under U locks\n",
+               writers[0].result, writers[1].result);
+        return -1;
+    }
+    closeIndex(idx);
+    return 0;
+}
+
+#define HANDLE_SLOTS 64
+
+/*
+ The slot of an index name in the handle cache of a thread: the FNV-1a hash used by
+ openIndex(), modulo its HANDLE_CACHE_SIZE.
+ */
+static unsigned int handle_slot(const char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)(*name++);
+        hash *= 16777619u;
+    }
+    return hash & (HANDLE_SLOTS - 1);
+}
+
+/*
+ Creates an INT index holding keys first to last.
+ */
+static int handle_index(char *name, int first, int last)
+{
+    IdxState *idx;
+    Key k;
+    int i;
+
+    if (create(INT, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create %s\n", name);
+        return -1;
+    }
+    for (i = first; i <= last; i++) {
+        set_key(&k, INT, i);
+        if (insertRecord(idx, NULL, &k, "handle") != SUCCESS) {
+            return -1;
+        }
+    }
+    return closeIndex(idx) == SUCCESS ? 0 : -1;
+}
+
+/*
+ get() of key v out of a transaction returns want.
+ */
+static int handle_get(IdxState *idx, int v, ErrCode want)
+{
+    Record record;
+
+    memset(&record, 0, sizeof(Record));
+    set_key(&record.key, INT, v);
+    return get(idx, NULL, &record) == want ? 0 : -1;
+}
+
+/*
+ The closed handle of an index is reopened by the same thread, with its cursor and lastKey
+ cleared: the first getNext() of a transaction starts from the first key again.
+ */
+static int test_handle_reuse(char *name)
+{
+    IdxState *idx, *again;
+    TxnState *txn;
+    Record record;
+
+    if (handle_index(name, 0, 9) != 0 || openIndex(name, &idx) != SUCCESS ||
+        beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    set_key(&record.key, INT, 5);
+    if (get(idx, txn, &record) != SUCCESS || getNext(idx, txn, &record) != SUCCESS ||
+        key_number(&record.key) != 6 || commitTransaction(txn) != SUCCESS) {
+        printf("could not read on from key 5 of %s\n", name);
+        return -1;
+    }
+    closeIndex(idx);
+
+    if (openIndex(name, &again) != SUCCESS || again != idx) {
+        printf("the closed handle of %s was not reused\n", name);
+        return -1;
+    }
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    if (getNext(again, txn, &record) != SUCCESS || key_number(&record.key) != 0) {
+        printf("a reused handle of %s read on from its old cursor\n", name);
+        return -1;
+    }
+    if (commitTransaction(txn) != SUCCESS) {
+        return -1;
+    }
+    closeIndex(again);
+    return 0;
+}
+
+/*
+ Two indices whose names share a slot of the handle cache: closing the handle of one evicts
+ the handle of the other, and each is opened on its own index.
+ */
+static int test_handle_slots(char *prefix)
+{
+    char a[32], b[32];
+    IdxState *idx, *other;
+    int i;
+
+    sprintf(a, "%s_a", prefix);
+    for (i = 0; ; i++) {
+        sprintf(b, "%s_%d", prefix, i);
+        if (handle_slot(b) == handle_slot(a)) {
+            break;
+        }
+    }
+    if (handle_index(a, 1, 1) != 0 || handle_index(b, 2, 2) != 0) {
+        return -1;
+    }
+
+    //the handle of b takes the slot of the handle of a.
+    if (openIndex(a, &idx) != SUCCESS || closeIndex(idx) != SUCCESS ||
+        openIndex(b, &other) != SUCCESS || closeIndex(other) != SUCCESS) {
+        return -1;
+    }
+    if (openIndex(a, &idx) != SUCCESS || idx == other ||
+        handle_get(idx, 1, SUCCESS) != 0 || handle_get(idx, 2, KEY_NOTFOUND) != 0) {
+        printf("%s was opened on the handle of %s\n", a, b);
+        return -1;
+    }
+    closeIndex(idx);
+    if (openIndex(b, &other) != SUCCESS || other == idx ||
+        handle_get(other, 2, SUCCESS) != 0 || handle_get(other, 1, KEY_NOTFOUND) != 0) {
+        printf("%s was opened on the handle of %s\n", b, a);
+        return -1;
+    }
+    closeIndex(other);
+    return 0;
+}
+
+/*
+ A handle closed while its transaction is still open is freed, not kept for the next
+ openIndex(). That transaction can not end without its handle, so the index is left to it.
+ */
+static int test_handle_in_txn(char *name, char *other)
+{
+    IdxState *idx, *cached, *next, *again;
+    TxnState *txn;
+    Key k;
+
+    //take the cached handle of other, its next one is a new handle.
+    if (handle_index(name, 0, 0) != 0 || handle_index(other, 0, 0) != 0 ||
+        openIndex(other, &cached) != SUCCESS || openIndex(name, &idx) != SUCCESS ||
+        beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    set_key(&k, INT, 1);
+    if (insertRecord(idx, txn, &k, "handle") != SUCCESS) {
+        return -1;
+    }
+    closeIndex(idx);
+
+    //the new handle takes the freed one back, a cached one would be opened again.
+    if (openIndex(other, &next) != SUCCESS || openIndex(name, &again) != SUCCESS) {
+        return -1;
+    }
+    if (again == idx) {
+        printf("a handle of %s closed in its transaction was reused\n", name);
+        return -1;
+    }
+    closeIndex(again);
+    closeIndex(next);
+    closeIndex(cached);
+    return 0;
+}
+
+/*
+ indexStats() counts the keys and records of an index and the memory it holds, as the index
+ grows and shrinks, down to the blocks given back once it is empty; an unknown index is DB_DNE.
+ */
+static int test_index_stats(KeyType type, char *name)
+{
+    IndexStats empty, full, half, none;
+    IdxState *idx;
+    Record record;
+    Key k;
+    char payload[16];
+    int i;
+
+    if (indexStats("no such index", &empty) != DB_DNE) {
+        printf("indexStats of an unknown index is not DB_DNE\n");
+        return -1;
+    }
+    if (create(type, name) != SUCCESS || openIndex(name, &idx) != SUCCESS ||
+        indexStats(name, &empty) != SUCCESS) {
+        printf("could not create %s\n", name);
+        return -1;
+    }
+    if (empty.keys != 0 || empty.records != 0 || empty.used > empty.reserved) {
+        printf("empty index has %llu keys and %llu records\n",
+               (unsigned long long)empty.keys, (unsigned long long)empty.records);
+        return -1;
+    }
+    //200000 keys, each 10th with a second record.
+    for (i = 0; i < 200000; i++) {
+        set_key(&k, type, i);
+        sprintf(payload, "%d", i);
+        if (insertRecord(idx, NULL, &k, payload) != SUCCESS ||
+            (i % 10 == 0 && insertRecord(idx, NULL, &k, "second") != SUCCESS)) {
+            printf("could not insert key %d into %s\n", i, name);
+            return -1;
+        }
+    }
+    if (indexStats(name, &full) != SUCCESS) {
+        return -1;
+    }
+    if (full.keys != 200000 || full.records != 220000 || full.used <= empty.used ||
+        full.used > full.reserved || full.objects < full.records ||
+        full.bytes_per_key != (double)full.reserved / full.keys) {
+        printf("loaded index has %llu keys, %llu records, %llu of %llu bytes used in %llu objects\n",
+               (unsigned long long)full.keys, (unsigned long long)full.records,
+               (unsigned long long)full.used, (unsigned long long)full.reserved,
+               (unsigned long long)full.objects);
+        return -1;
+    }
+    for (i = 0; i < 200000; i += 2) {
+        memset(&record, 0, sizeof(Record));
+        set_key(&record.key, type, i);
+        if (deleteRecord(idx, NULL, &record) != SUCCESS) {
+            return -1;
+        }
+    }
+    if (compactIndex(name) != SUCCESS || indexStats(name, &half) != SUCCESS) {
+        return -1;
+    }
+    if (half.keys != 100000 || half.records != 100000 || half.used >= full.used ||
+        half.used > half.reserved) {
+        printf("half deleted %s has %llu keys, %llu records, %llu of %llu bytes used (%llu of %llu before)\n", name,
+               (unsigned long long)half.keys, (unsigned long long)half.records,
+               (unsigned long long)half.used, (unsigned long long)half.reserved,
+               (unsigned long long)full.used, (unsigned long long)full.reserved);
+        return -1;
+    }
+    //only the blocks of the objects the thread caches hold are kept.
+    for (i = 1; i < 200000; i += 2) {
+        memset(&record, 0, sizeof(Record));
+        set_key(&record.key, type, i);
+        if (deleteRecord(idx, NULL, &record) != SUCCESS) {
+            return -1;
+        }
+    }
+    if (compactIndex(name) != SUCCESS || indexStats(name, &none) != SUCCESS) {
+        return -1;
+    }
+    if (none.keys != 0 || none.records != 0 || none.reserved > full.reserved / 4) {
+        printf("emptied %s has %llu keys, %llu records, %llu bytes reserved (%llu before)\n", name,
+               (unsigned long long)none.keys, (unsigned long long)none.records,
+               (unsigned long long)none.reserved, (unsigned long long)full.reserved);
+        return -1;
+    }
+    closeIndex(idx);
+    return 0;
+}
+
+/*
+ Orders two keys of the same type as the index does.
+ */
+static int key_cmp(const Key *k1, const Key *k2)
+{
+    if (k1->type == SHORT) {
+        return (k1->keyval.shortkey > k2->keyval.shortkey) - (k1->keyval.shortkey < k2->keyval.shortkey);
+    } else if (k1->type == INT) {
+        return (k1->keyval.intkey > k2->keyval.intkey) - (k1->keyval.intkey < k2->keyval.intkey);
+    }
+    return strcmp(k1->keyval.charkey, k2->keyval.charkey);
+}
+
+/*
+ Orders two records by key, then by payload.
+ */
+static int record_cmp(const void *p1, const void *p2)
+{
+    const Record *r1 = (const Record*)p1, *r2 = (const Record*)p2;
+    int cmp = key_cmp(&r1->key, &r2->key);
+
+    return (cmp != 0) ? cmp : strcmp(r1->payload, r2->payload);
+}
+
+/*
+ Scans the whole index in one transaction into records (room for max), checking that the keys
+ come in order. Returns the number of records, -1 on an error.
+ */
+static int dump_index(IdxState *idx, Record *records, int max)
+{
+    TxnState *txn;
+    int n = 0, errCode;
+
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    while (n < max) {
+        memset(&records[n], 0, sizeof(Record));
+        if ((errCode = getNext(idx, txn, &records[n])) != SUCCESS) {
+            break;
+        }
+        if (n > 0 && key_cmp(&records[n - 1].key, &records[n].key) > 0) {
+            printf("scan returned a key out of order\n");
+            abortTransaction(txn);
+            return -1;
+        }
+        n++;
+    }
+    if (n == max || errCode != DB_END || commitTransaction(txn) != SUCCESS) {
+        printf("could not scan the whole index -- %d\n", errCode);
+        return -1;
+    }
+    return n;
+}
+
+/*
+ Checks that the two indices hold the same records, in the same key order.
+ */
+static int compare_indices(IdxState *idx1, IdxState *idx2, int max)
+{
+    Record *records1 = malloc(max * sizeof(Record)), *records2 = malloc(max * sizeof(Record));
+    int n1, n2, i, ret = -1;
+
+    n1 = dump_index(idx1, records1, max);
+    n2 = dump_index(idx2, records2, max);
+    if (n1 < 0 || n1 != n2) {
+        printf("indices have %d and %d records\n", n1, n2);
+        goto done;
+    }
+    //the payloads of a key may come in another order.
+    qsort(records1, n1, sizeof(Record), record_cmp);
+    qsort(records2, n2, sizeof(Record), record_cmp);
+    for (i = 0; i < n1; i++) {
+        if (record_cmp(&records1[i], &records2[i]) != 0) {
+            printf("indices differ at record %d (payload %s and %s)\n", i,
+                   records1[i].payload, records2[i].payload);
+            goto done;
+        }
+    }
+    ret = 0;
+done:
+    free(records1);
+    free(records2);
+    return ret;
+}
+
+/*
+ n records of the given type in random order, on about n/4 keys, some repeated; the VARCHAR
+ keys are of all lengths, so some are the prefixes of others.
+ */
+static Record *random_records(KeyType type, int n, unsigned int seed)
+{
+    Record *records = malloc(n * sizeof(Record));
+    int i, v;
+
+    for (i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        v = (seed >> 8) % (n / 4);
+        memset(&records[i], 0, sizeof(Record));
+        if (type == VARCHAR) {
+            records[i].key.type = VARCHAR;
+            records[i].key.keyval.charkey[0] = 'k';
+            spell_number(records[i].key.keyval.charkey + 1, v, 0);
+        } else {
+            set_key(&records[i].key, type, v);
+        }
+        seed = seed * 1103515245 + 12345;
+        sprintf(records[i].payload, "payload %d", (seed >> 8) % 8);
+    }
+    return records;
+}
+
+/*
+ Loads the same records with loader (or one by one if loader is NULL) into the index name.
+ */
+typedef ErrCode (*LoadFunc)(IdxState *idx, const Record *records, size_t n, int sorted, int threads);
+
+static int load_index(char *name, KeyType type, const Record *records, int n, LoadFunc loader,
+                      int sorted, int threads, IdxState **idx)
+{
+    int i, errCode;
+
+    if (create(type, name) != SUCCESS || openIndex(name, idx) != SUCCESS) {
+        printf("could not create %s\n", name);
+        return -1;
+    }
+    if (loader != NULL) {
+        if ((errCode = loader(*idx, records, n, sorted, threads)) != SUCCESS) {
+            printf("could not load %s -- %d\n", name, errCode);
+            return -1;
+        }
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        errCode = insertRecord(*idx, NULL, (Key*)&records[i].key, records[i].payload);
+        if (errCode != SUCCESS && errCode != ENTRY_EXISTS) {
+            printf("could not insert record %d into %s -- %d\n", i, name, errCode);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static ErrCode bulk_loader(IdxState *idx, const Record *records, size_t n, int sorted, int threads)
+{
+    return bulkLoad(idx, records, n, sorted);
+}
+
+/*
+ bulkLoad() into an empty index, of the records as they are and sorted, and into an index that
+ is not empty, must give the index the inserts one by one give.
+ */
+static int test_bulk_load(KeyType type, char *prefix)
+{
+    int n = 20000;
+    Record *records = random_records(type, n, 12345 + type);
+    IdxState *one_by_one, *bulk;
+    char name[64];
+
+    sprintf(name, "%s_inserted", prefix);
+    if (load_index(name, type, records, n, NULL, 0, 0, &one_by_one) != 0) {
+        return -1;
+    }
+    sprintf(name, "%s_bulk", prefix);
+    if (load_index(name, type, records, n, bulk_loader, 0, 0, &bulk) != 0 ||
+        compare_indices(one_by_one, bulk, n + 1) != 0) {
+        printf("bulkLoad of unsorted records differs from the inserts\n");
+        return -1;
+    }
+    //a bulk load into an index with records inserts them.
+    if (bulkLoad(bulk, records, n / 2, 0) != SUCCESS ||
+        compare_indices(one_by_one, bulk, n + 1) != 0) {
+        printf("bulkLoad into a loaded index differs from the inserts\n");
+        return -1;
+    }
+    closeIndex(bulk);
+
+    qsort(records, n, sizeof(Record), record_cmp);
+    sprintf(name, "%s_sorted", prefix);
+    if (load_index(name, type, records, n, bulk_loader, 1, 0, &bulk) != 0 ||
+        compare_indices(one_by_one, bulk, n + 1) != 0) {
+        printf("bulkLoad of sorted records differs from the inserts\n");
+        return -1;
+    }
+    closeIndex(bulk);
+    closeIndex(one_by_one);
+    free(records);
+    return 0;
+}
+
+/*
+ parallelBulkLoad() on any number of threads must give the index the inserts one by one give,
+ also when all the keys share their first bytes or are the same key.
+ */
+static int test_parallel_bulk_load(KeyType type, char *prefix)
+{
+    //enough records to be loaded in parallel.
+    int n = 70000, threads[4] = {0, 2, 4, 7}, i, t;
+    Record *records = random_records(type, n, 54321 + type);
+    IdxState *one_by_one, *parallel;
+    char name[64], key[MAX_VARCHAR_LEN + 1];
+
+    for (t = 0; t < 3; t++) {
+        if (t == 1) {
+            //the first position that tells the keys apart is deep in them.
+            for (i = 0; i < n; i++) {
+                if (type == VARCHAR) {
+                    sprintf(key, "a_long_shared_prefix_%s", records[i].key.keyval.charkey);
+                    strcpy(records[i].key.keyval.charkey, key);
+                } else {
+                    set_key(&records[i].key, type, key_number(&records[i].key) % 200);
+                }
+            }
+        } else if (t == 2) {
+            for (i = 0; i < n; i++) {
+                records[i].key = records[0].key;
+            }
+        }
+        sprintf(name, "%s_inserted%d", prefix, t);
+        if (load_index(name, type, records, n, NULL, 0, 0, &one_by_one) != 0) {
+            return -1;
+        }
+        for (i = 0; i < 4; i++) {
+            sprintf(name, "%s_parallel%d_%d", prefix, t, threads[i]);
+            if (load_index(name, type, records, n, parallelBulkLoad, 0, threads[i], &parallel) != 0 ||
+                compare_indices(one_by_one, parallel, n + 1) != 0) {
+                printf("parallelBulkLoad on %d threads differs from the inserts\n", threads[i]);
+                return -1;
+            }
+            closeIndex(parallel);
+        }
+        closeIndex(one_by_one);
+    }
+    free(records);
+    return 0;
+}
+
+/*
+ The bytes a VARCHAR key may hold.
+ */
+#define KEY_BYTE_FIRST 0x01
+#define KEY_BYTE_LAST 0xff
+
+/*
+ A key of the type strictly between k1 and k2 (k1 NULL for below k2, k2 NULL for above k1) into
+ probe; returns 0 if there is none.
+ */
+static int key_between(KeyType type, const Key *k1, const Key *k2, Key *probe)
+{
+    memset(probe, 0, sizeof(Key));
+    probe->type = type;
+    if (type == SHORT) {
+        int64_t v = (k2 != NULL) ? (int64_t)k2->keyval.shortkey - 1 : (int64_t)k1->keyval.shortkey + 1;
+        if (v < INT32_MIN || v > INT32_MAX || (k1 != NULL && v <= k1->keyval.shortkey)) {
+            return 0;
+        }
+        probe->keyval.shortkey = (int32_t)v;
+    } else if (type == INT) {
+        if (k2 != NULL && (k2->keyval.intkey == INT64_MIN ||
+                           (k1 != NULL && k2->keyval.intkey - 1 <= k1->keyval.intkey))) {
+            return 0;
+        }
+        if (k2 == NULL && k1->keyval.intkey == INT64_MAX) {
+            return 0;
+        }
+        probe->keyval.intkey = (k2 != NULL) ? k2->keyval.intkey - 1 : k1->keyval.intkey + 1;
+    } else {
+        size_t len = (k1 != NULL) ? strlen(k1->keyval.charkey) : 0;
+        if (k1 == NULL || len == MAX_VARCHAR_LEN) {
+            return 0;
+        }
+        strcpy(probe->keyval.charkey, k1->keyval.charkey);
+        probe->keyval.charkey[len] = KEY_BYTE_FIRST;
+        probe->keyval.charkey[len + 1] = '\0';
+        if (k2 != NULL && key_cmp(probe, k2) >= 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#define SEARCH_KEYS 257
+
+/*
+ The n keys (n > 1) of the spread for an index of the given type, in order: over the whole key
+ range, across zero, at the bottom and the top of the range, and with only the middle bytes set.
+ */
+static void spread_keys(KeyType type, int spread, int n, Key *keys)
+{
+    int64_t lo = (type == SHORT) ? INT32_MIN : INT64_MIN, hi = (type == SHORT) ? INT32_MAX : INT64_MAX;
+    uint64_t step = 2, base;
+    int64_t v;
+    int i;
+
+    if (spread == 0) {
+        step = ((uint64_t)hi - (uint64_t)lo) / (n - 1);
+        base = (uint64_t)lo;
+    } else if (spread == 1) {
+        base = (uint64_t)(int64_t)-n;
+    } else if (spread == 2) {
+        base = (uint64_t)lo;
+    } else if (spread == 3) {
+        base = (uint64_t)hi - 2 * (n - 1);
+    } else {
+        step = 1 << 8;
+        base = 1 << 20;
+    }
+    for (i = 0; i < n; i++) {
+        v = (spread == 0 && i == n - 1) ? hi : (int64_t)(base + i * step);
+        memset(&keys[i], 0, sizeof(Key));
+        keys[i].type = type;
+        if (type == SHORT) {
+            keys[i].keyval.shortkey = (int32_t)v;
+        } else {
+            keys[i].keyval.intkey = v;
+        }
+    }
+}
+
+/*
+ An INT/SHORT container is searched by a binary search down to a window, then a count of the
+ keys less than the key in it (in SIMD where the CPU has it). Every key of containers of the sizes
+ around the window and the vectors, with parts of every width, is found; the keys between them
+ are not, and getNext() after them returns the next key.
+ */
+static int test_count_less(KeyType type, char *prefix)
+{
+    static const int sizes[] = {2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 34, 63, 64, 65,
+                                127, 128, 129, 255, 256, SEARCH_KEYS};
+    Key keys[SEARCH_KEYS], probe;
+    int order[SEARCH_KEYS];
+    unsigned int seed = 5;
+    IdxState *idx;
+    TxnState *txn;
+    Record record;
+    char name[64], payload[16];
+    int s, spread, n, i, j, tmp, errCode;
+
+    for (spread = 0; spread < 5; spread++) {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            n = sizes[s];
+            spread_keys(type, spread, n, keys);
+            sprintf(name, "%s_%d_%d", prefix, spread, n);
+            if (create(type, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+                printf("could not create %s\n", name);
+                return -1;
+            }
+            for (i = 0; i < n; i++) {
+                order[i] = i;
+            }
+            for (i = n - 1; i > 0; i--) {
+                j = rand_r(&seed) % (i + 1);
+                tmp = order[i];
+                order[i] = order[j];
+                order[j] = tmp;
+            }
+            for (i = 0; i < n; i++) {
+                sprintf(payload, "%d", order[i]);
+                if (insertRecord(idx, NULL, &keys[order[i]], payload) != SUCCESS) {
+                    printf("could not insert key %d into %s\n", order[i], name);
+                    return -1;
+                }
+            }
+
+            if (beginTransaction(&txn) != SUCCESS) {
+                return -1;
+            }
+            for (i = 0; i <= n; i++) {
+                if (key_between(type, (i > 0) ? &keys[i - 1] : NULL, (i < n) ? &keys[i] : NULL, &probe)) {
+                    memset(&record, 0, sizeof(Record));
+                    record.key = probe;
+                    if ((errCode = get(idx, txn, &record)) != KEY_NOTFOUND) {
+                        printf("found a key before key %d of %s -- %d\n", i, name, errCode);
+                        return -1;
+                    }
+                    memset(&record, 0, sizeof(Record));
+                    errCode = getNext(idx, txn, &record);
+                    if (i == n ? (errCode != DB_END) : (errCode != SUCCESS || atoi(record.payload) != i)) {
+                        printf("getNext after a miss before key %d of %s returned %d (payload %s)\n",
+                               i, name, errCode, record.payload);
+                        return -1;
+                    }
+                }
+                if (i == n) {
+                    break;
+                }
+                memset(&record, 0, sizeof(Record));
+                record.key = keys[i];
+                if (get(idx, txn, &record) != SUCCESS || atoi(record.payload) != i) {
+                    printf("could not find key %d of %s\n", i, name);
+                    return -1;
+                }
+            }
+            if (commitTransaction(txn) != SUCCESS) {
+                return -1;
+            }
+            closeIndex(idx);
+        }
+    }
+    return 0;
+}
+
+static int key_sort_cmp(const void *k1, const void *k2)
+{
+    return key_cmp((const Key*)k1, (const Key*)k2);
+}
+
+/*
+ After a get() that misses, getNext() returns the least key above the missed one, across the
+ containers and down to the ends of the key range; DB_END above the greatest.
+ */
+static int test_next_after_miss(KeyType type, char *name)
+{
+    static const char *strings[] = {"", "\x01", "a", "a\x01", "ab", "a\x7f", "a\x80", "a\xff", "b",
+                                    "\x7f", "\x80", "\x80\x80", "\xfe\xff", "\xff", "\xff\xff"};
+    int64_t ints[] = {INT64_MIN, INT64_MIN + 1, -(1LL << 32), -256, -1, 0, 1, 255, 256,
+                      1LL << 32, INT64_MAX - 1, INT64_MAX};
+    int n = 0, i, errCode, extremes;
+    unsigned int seed = 777;
+    Key keys[3000], probe;
+    IdxState *idx;
+    TxnState *txn;
+    Record record;
+    char payload[16];
+
+    extremes = (type == VARCHAR) ? sizeof(strings) / sizeof(strings[0]) : sizeof(ints) / sizeof(ints[0]);
+    for (i = 0; i < 3000; i++) {
+        memset(&keys[i], 0, sizeof(Key));
+        keys[i].type = type;
+        seed = seed * 1103515245 + 12345;
+        if (type == VARCHAR) {
+            if (i < extremes) {
+                strcpy(keys[i].keyval.charkey, strings[i]);
+            } else {
+                keys[i].keyval.charkey[0] = 'a' + (seed >> 8) % 3;
+                spell_number(keys[i].keyval.charkey + 1, (seed >> 12) % 40000, 0);
+            }
+        } else if (type == INT) {
+            keys[i].keyval.intkey = (i < extremes) ? ints[i] : (int64_t)((uint64_t)seed << 40) + (seed >> 4);
+        } else {
+            keys[i].keyval.shortkey = (i < extremes) ? (int32_t)(ints[i] < INT32_MIN ? INT32_MIN :
+                                      (ints[i] > INT32_MAX ? INT32_MAX : ints[i])) :
+                                      (int32_t)((seed >> 3) * 7919);
+        }
+    }
+    qsort(keys, 3000, sizeof(Key), key_sort_cmp);
+    for (i = 0; i < 3000; i++) {
+        if (n == 0 || key_cmp(&keys[n - 1], &keys[i]) != 0) {
+            keys[n++] = keys[i];
+        }
+    }
+
+    if (create(type, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create %s\n", name);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        sprintf(payload, "%d", i);
+        if (insertRecord(idx, NULL, &keys[i], payload) != SUCCESS) {
+            printf("could not insert key %d into %s\n", i, name);
+            return -1;
+        }
+    }
+
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    for (i = 0; i <= n; i++) {
+        if (!key_between(type, (i > 0) ? &keys[i - 1] : NULL, (i < n) ? &keys[i] : NULL, &probe)) {
+            continue;
+        }
+        memset(&record, 0, sizeof(Record));
+        record.key = probe;
+        if ((errCode = get(idx, txn, &record)) != KEY_NOTFOUND) {
+            printf("get of a key not in %s returned %d\n", name, errCode);
+            return -1;
+        }
+        memset(&record, 0, sizeof(Record));
+        errCode = getNext(idx, txn, &record);
+        if (i == n ? (errCode != DB_END) :
+            (errCode != SUCCESS || key_cmp(&record.key, &keys[i]) != 0 || atoi(record.payload) != i)) {
+            printf("getNext after a miss before key %d of %d in %s returned %d (payload %s)\n",
+                   i, n, name, errCode, record.payload);
+            return -1;
+        }
+    }
+    if (commitTransaction(txn) != SUCCESS) {
+        return -1;
+    }
+    closeIndex(idx);
+    return 0;
+}
+
+#define FRONT_KEYS 4000
+
+/*
+ Checks that the index holds exactly the keys (sorted, n of them) marked in present, with their
+ numbers as payloads, in a scan and in a get of each key.
+ */
+static int check_front_coded(IdxState *idx, const Key *keys, const char *present, int n)
+{
+    Record *records = malloc((n + 1) * sizeof(Record));
+    Record record;
+    int i, j, count, errCode, ret = -1;
+
+    if ((count = dump_index(idx, records, n + 1)) < 0) {
+        goto done;
+    }
+    for (i = 0, j = 0; i < n; i++) {
+        if (!present[i]) {
+            continue;
+        }
+        if (j >= count || strcmp(records[j].key.keyval.charkey, keys[i].keyval.charkey) != 0 ||
+            atoi(records[j].payload) != i) {
+            printf("scan returned key %d (payload %s) instead of key %d\n", j,
+                   j < count ? records[j].payload : "none", i);
+            goto done;
+        }
+        j++;
+    }
+    if (j != count) {
+        printf("scan returned %d keys, not %d\n", count, j);
+        goto done;
+    }
+    for (i = 0; i < n; i++) {
+        memset(&record, 0, sizeof(Record));
+        record.key = keys[i];
+        errCode = get(idx, NULL, &record);
+        if (present[i] ? (errCode != SUCCESS || atoi(record.payload) != i) : errCode != KEY_NOTFOUND) {
+            printf("get of key %d (%s) returned %d, payload %s\n", i,
+                   present[i] ? "present" : "deleted", errCode, record.payload);
+            goto done;
+        }
+    }
+    ret = 0;
+done:
+    free(records);
+    return ret;
+}
+
+/*
+ VARCHAR keys are front coded in their containers; keys of all lengths on a few long prefixes,
+ with bytes above 0x7f, are inserted, deleted and inserted again in random order.
+ */
+static int test_front_coding(char *name)
+{
+    unsigned char prefixes[4][MAX_VARCHAR_LEN];
+    Key *keys = malloc(FRONT_KEYS * sizeof(Key));
+    int *order = malloc(FRONT_KEYS * sizeof(int));
+    char *present = calloc(FRONT_KEYS, 1);
+    unsigned int seed = 17;
+    IdxState *idx;
+    Record record;
+    char payload[16];
+    int i, j, n, len, shared, t, tmp, ret = -1;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < MAX_VARCHAR_LEN; j++) {
+            prefixes[i][j] = KEY_BYTE_FIRST + rand_r(&seed) % (KEY_BYTE_LAST - KEY_BYTE_FIRST + 1);
+        }
+    }
+    //keys of 1 to MAX_VARCHAR_LEN bytes, sharing any part of a prefix.
+    for (i = 0; i < FRONT_KEYS; i++) {
+        memset(&keys[i], 0, sizeof(Key));
+        keys[i].type = VARCHAR;
+        len = 1 + rand_r(&seed) % MAX_VARCHAR_LEN;
+        shared = rand_r(&seed) % (len + 1);
+        memcpy(keys[i].keyval.charkey, prefixes[rand_r(&seed) % 4], shared);
+        for (j = shared; j < len; j++) {
+            keys[i].keyval.charkey[j] = KEY_BYTE_FIRST + rand_r(&seed) % (KEY_BYTE_LAST - KEY_BYTE_FIRST + 1);
+        }
+    }
+    qsort(keys, FRONT_KEYS, sizeof(Key), key_sort_cmp);
+    for (i = 1, n = 1; i < FRONT_KEYS; i++) {
+        if (strcmp(keys[i].keyval.charkey, keys[n - 1].keyval.charkey) != 0) {
+            keys[n++] = keys[i];
+        }
+    }
+    for (i = 0; i < n; i++) {
+        order[i] = i;
+    }
+
+    if (create(VARCHAR, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create %s\n", name);
+        goto done;
+    }
+    //insert all, delete two thirds, insert them again; each in a new random order.
+    for (t = 0; t < 3; t++) {
+        for (i = n - 1; i > 0; i--) {
+            j = rand_r(&seed) % (i + 1);
+            tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+        for (i = 0; i < (t == 1 ? n * 2 / 3 : n); i++) {
+            if (present[order[i]] == (t != 1)) {
+                continue;
+            }
+            memset(&record, 0, sizeof(Record));
+            record.key = keys[order[i]];
+            sprintf(payload, "%d", order[i]);
+            if ((t == 1 ? deleteRecord(idx, NULL, &record) :
+                          insertRecord(idx, NULL, &record.key, payload)) != SUCCESS) {
+                printf("could not %s key %d\n", t == 1 ? "delete" : "insert", order[i]);
+                goto done;
+            }
+            present[order[i]] = (t != 1);
+        }
+        if (check_front_coded(idx, keys, present, n) != 0) {
+            goto done;
+        }
+    }
+    closeIndex(idx);
+    ret = 0;
+done:
+    free(keys);
+    free(order);
+    free(present);
+    return ret;
+}
+
+/*
+ Deletes (or inserts) the record (key v, payload) in txn; deletes all the records of the key
+ if payload is empty.
+ */
+static int change_record(IdxState *idx, TxnState *txn, KeyType type, int v, const char *payload,
+                         int insert)
+{
+    Record record;
+    int errCode;
+
+    memset(&record, 0, sizeof(Record));
+    set_key(&record.key, type, v);
+    strcpy(record.payload, payload);
+    if (insert) {
+        errCode = insertRecord(idx, txn, &record.key, payload);
+    } else {
+        errCode = deleteRecord(idx, txn, &record);
+    }
+    if (errCode != SUCCESS) {
+        printf("could not %s (%d, %s) -- %d\n", insert ? "insert" : "delete", v, payload, errCode);
+        return -1;
+    }
+    return 0;
+}
+
+#define SET_RECORDS 200
+
+/*
+ Reads all the records of the key v in one transaction, counting the payloads "r<i>" in seen (of
+ SET_RECORDS). Returns the number of records, -1 if a payload is not one of seen or is read twice.
+ */
+static int key_payloads(IdxState *idx, KeyType type, int v, int *seen)
+{
+    TxnState *txn;
+    Record record;
+    int errCode, count, r;
+
+    memset(seen, 0, SET_RECORDS * sizeof(int));
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    set_key(&record.key, type, v);
+    errCode = get(idx, txn, &record);
+    for (count = 0; errCode == SUCCESS && key_number(&record.key) == v; count++) {
+        r = atoi(record.payload + 1);
+        if (record.payload[0] != 'r' || r < 0 || r >= SET_RECORDS || seen[r]++ != 0) {
+            printf("key %d has the payload %s twice or out of the set\n", v, record.payload);
+            abortTransaction(txn);
+            return -1;
+        }
+        errCode = getNext(idx, txn, &record);
+    }
+    if (errCode != SUCCESS || key_number(&record.key) != v + 1) {
+        printf("getNext after the records of key %d returned key %d -- %d\n", v,
+               key_number(&record.key), errCode);
+        abortTransaction(txn);
+        return -1;
+    }
+    if (commitTransaction(txn) != SUCCESS) {
+        return -1;
+    }
+    return count;
+}
+
+/*
+ A key with more than RECORD_SET_MIN records keeps them in a set: the duplicates, the deletes of
+ one record, the aborts and the scans must behave as with a few records, also once the deletes
+ drop the set and the inserts build it again.
+ */
+static int test_record_set(KeyType type, char *name)
+{
+    int seen[SET_RECORDS];
+    IdxState *idx;
+    TxnState *txn;
+    Record record;
+    char payload[16];
+    int i;
+
+    if (create(type, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create %s\n", name);
+        return -1;
+    }
+    //key 5 between single record keys, its records in a scattered order.
+    for (i = 4; i <= 6; i += 2) {
+        if (change_record(idx, NULL, type, i, "r0", 1) != 0) {
+            return -1;
+        }
+    }
+    for (i = 0; i < SET_RECORDS; i++) {
+        sprintf(payload, "r%d", (i * 77) % SET_RECORDS);
+        if (change_record(idx, NULL, type, 5, payload, 1) != 0) {
+            return -1;
+        }
+    }
+    set_key(&record.key, type, 5);
+    if (insertRecord(idx, NULL, &record.key, "r123") != ENTRY_EXISTS) {
+        printf("could insert a record of a set twice\n");
+        return -1;
+    }
+    if (key_payloads(idx, type, 5, seen) != SET_RECORDS) {
+        printf("a scan did not return the %d records of a set\n", SET_RECORDS);
+        return -1;
+    }
+
+    //an aborted delete of most of the set, and an insert, leaves it whole.
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    for (i = 0; i < SET_RECORDS - 10; i++) {
+        sprintf(payload, "r%d", i);
+        if (change_record(idx, txn, type, 5, payload, 0) != 0) {
+            return -1;
+        }
+    }
+    if (change_record(idx, txn, type, 5, "r-1", 1) != 0 || abortTransaction(txn) != SUCCESS ||
+        key_payloads(idx, type, 5, seen) != SET_RECORDS) {
+        printf("aborted delete changed the set\n");
+        return -1;
+    }
+
+    //r123 goes in last, a record appended after its delete follows the others.
+    if (change_record(idx, NULL, type, 5, "r123", 0) != 0 ||
+        change_record(idx, NULL, type, 5, "r123", 1) != 0 ||
+        change_record(idx, NULL, type, 5, "r123", 0) != 0 ||
+        change_record(idx, NULL, type, 5, "r123", 1) != 0 ||
+        key_payloads(idx, type, 5, seen) != SET_RECORDS) {
+        printf("the set lost its records after a delete of the last\n");
+        return -1;
+    }
+
+    //deletes of single records down to 10 drop the set.
+    for (i = 1; i < SET_RECORDS; i++) {
+        sprintf(payload, "r%d", i);
+        if (i % 20 != 0 && change_record(idx, NULL, type, 5, payload, 0) != 0) {
+            return -1;
+        }
+    }
+    strcpy(record.payload, "r21");
+    if (deleteRecord(idx, NULL, &record) != KEY_NOTFOUND ||
+        insertRecord(idx, NULL, &record.key, "r40") != ENTRY_EXISTS) {
+        printf("a dropped set lost track of its records\n");
+        return -1;
+    }
+    if (key_payloads(idx, type, 5, seen) != SET_RECORDS / 20) {
+        return -1;
+    }
+    for (i = 0; i < SET_RECORDS; i += 20) {
+        if (seen[i] != 1) {
+            printf("record r%d of key 5 was lost with the set\n", i);
+            return -1;
+        }
+    }
+
+    //and inserts build it again.
+    for (i = 1; i < SET_RECORDS; i++) {
+        sprintf(payload, "r%d", i);
+        if (i % 20 != 0 && change_record(idx, NULL, type, 5, payload, 1) != 0) {
+            return -1;
+        }
+    }
+    if (insertRecord(idx, NULL, &record.key, "r199") != ENTRY_EXISTS ||
+        key_payloads(idx, type, 5, seen) != SET_RECORDS) {
+        printf("the set built again does not have its %d records\n", SET_RECORDS);
+        return -1;
+    }
+    closeIndex(idx);
+    return 0;
+}
+
+/*
+ Checks that the index name has records records, payloads shared payloads, and as many
+ references to them as records.
+ */
+static int check_shared(char *name, uint64_t records, uint64_t payloads)
+{
+    IndexStats stats;
+
+    if (indexStats(name, &stats) != SUCCESS) {
+        printf("could not get the stats of %s\n", name);
+        return -1;
+    }
+    if (stats.records != records || stats.payloads != payloads || stats.payload_refs != records) {
+        printf("%s has %llu records, %llu payloads with %llu references; not %llu, %llu\n", name,
+               (unsigned long long)stats.records, (unsigned long long)stats.payloads,
+               (unsigned long long)stats.payload_refs, (unsigned long long)records,
+               (unsigned long long)payloads);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ An index sharing its payloads keeps one copy of each, counted by the records pointing to it:
+ the count must follow the deletes, the aborted deletes and inserts, and the commits.
+ */
+static int test_share_payloads(KeyType type, char *name)
+{
+    IdxState *idx;
+    TxnState *txn;
+    Record record;
+    char payload[16];
+    int i;
+
+    if (create(type, name) != SUCCESS || sharePayloads(name) != SUCCESS ||
+        openIndex(name, &idx) != SUCCESS) {
+        printf("could not create the shared index\n");
+        return -1;
+    }
+    //1000 keys with 10 payloads, the first 50 also with 5 others.
+    for (i = 0; i < 1000; i++) {
+        sprintf(payload, "p%d", i % 10);
+        if (change_record(idx, NULL, type, i, payload, 1) != 0) {
+            return -1;
+        }
+        sprintf(payload, "extra%d", i % 5);
+        if (i < 50 && change_record(idx, NULL, type, i, payload, 1) != 0) {
+            return -1;
+        }
+    }
+    set_key(&record.key, type, 7);
+    if (insertRecord(idx, NULL, &record.key, "p7") != ENTRY_EXISTS) {
+        printf("could insert a record twice into a shared index\n");
+        return -1;
+    }
+    if (check_shared(name, 1050, 15) != 0) {
+        return -1;
+    }
+
+    //the last record of p3 takes it out of the pool.
+    for (i = 3; i < 1000; i += 10) {
+        if (change_record(idx, NULL, type, i, "p3", 0) != 0) {
+            return -1;
+        }
+    }
+    if (check_shared(name, 950, 14) != 0) {
+        return -1;
+    }
+
+    //an aborted delete of all the records of the keys of p4 keeps every reference.
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    for (i = 4; i < 1000; i += 10) {
+        if (change_record(idx, txn, type, i, "", 0) != 0) {
+            return -1;
+        }
+    }
+    if (change_record(idx, txn, type, 4, "new payload", 1) != 0 ||
+        abortTransaction(txn) != SUCCESS || check_shared(name, 950, 14) != 0) {
+        printf("aborted delete changed the shared payloads\n");
+        return -1;
+    }
+    for (i = 4; i < 1000; i += 10) {
+        memset(&record, 0, sizeof(Record));
+        set_key(&record.key, type, i);
+        if (get(idx, NULL, &record) != SUCCESS || strcmp(record.payload, "p4") != 0) {
+            printf("aborted delete lost (%d, p4) -- %s\n", i, record.payload);
+            return -1;
+        }
+    }
+
+    //a committed one drops p5, but not the extra payloads of the keys left.
+    if (beginTransaction(&txn) != SUCCESS) {
+        return -1;
+    }
+    for (i = 5; i < 1000; i += 10) {
+        if (change_record(idx, txn, type, i, "", 0) != 0) {
+            return -1;
+        }
+    }
+    if (commitTransaction(txn) != SUCCESS || check_shared(name, 845, 13) != 0) {
+        printf("committed delete left the wrong shared payloads\n");
+        return -1;
+    }
+
+    //p3 is stored again, and all the references go with the keys.
+    if (change_record(idx, NULL, type, 3, "p3", 1) != 0 || check_shared(name, 846, 14) != 0) {
+        return -1;
+    }
+    for (i = 0; i < 1000; i++) {
+        if (i % 10 == 5 || (i % 10 == 3 && i >= 50)) {
+            continue;
+        }
+        if (change_record(idx, NULL, type, i, "", 0) != 0) {
+            return -1;
+        }
+    }
+    if (check_shared(name, 0, 0) != 0) {
+        return -1;
+    }
+    closeIndex(idx);
+    return 0;
+}
+
+/*
+ Scans the whole index in one transaction, counting the records of each key number in seen
+ (of n numbers). Returns the number of records, -1 if the scan is out of order or a payload is
+ not the number of its key.
+ */
+static int scan_index(IdxState *idx, int *seen, int n)
+{
+    int errCode, count, prev, v;
+    TxnState *txn;
+    Record record;
+
+scan_txn:
+    if (seen != NULL) {
+        memset(seen, 0, n * sizeof(int));
+    }
+    count = 0;
+    prev = -1;
+    if ((errCode = beginTransaction(&txn)) != SUCCESS) {
+        printf("could not begin a scan transaction\n");
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    while ((errCode = getNext(idx, txn, &record)) == SUCCESS) {
+        v = key_number(&record.key);
+        if (v < prev || v >= n || atoi(record.payload) % n != v) {
+            printf("scan returned key %d (payload %s) after key %d\n", v, record.payload, prev);
+            abortTransaction(txn);
+            return -1;
+        }
+        prev = v;
+        count++;
+        if (seen != NULL) {
+            seen[v]++;
+        }
+    }
+    if (errCode == DEADLOCK) {
+        abortTransaction(txn);
+        goto scan_txn;
+    }
+    if (errCode != DB_END) {
+        printf("scan did not end with DB_END -- %d\n", errCode);
+        abortTransaction(txn);
+        return -1;
+    }
+    if (commitTransaction(txn) != SUCCESS) {
+        printf("could not commit a scan transaction\n");
+        return -1;
+    }
+    return count;
+}
+
+/*
+ Bursts an index with keys keys, then deletes all but keep of them: the trie nodes left with
+ too few keys below them are merged back, so once compacted the index is laid out as one built
+ from the keys left. Its leaf links must still chain all the keys in order.
+ */
+static int test_merge_burst(KeyType type, char *name, char *few_name, int keys, int keep)
+{
+    static int seen[4096];
+    IndexStats merged, few;
+    IdxState *idx, *few_idx;
+    Record record;
+    Key k;
+    char payload[16];
+    int i, step = keys / keep;
+
+    if (create(type, name) != SUCCESS || openIndex(name, &idx) != SUCCESS ||
+        create(type, few_name) != SUCCESS || openIndex(few_name, &few_idx) != SUCCESS) {
+        printf("could not create the merge indices\n");
+        return -1;
+    }
+    for (i = 0; i < keys; i++) {
+        set_key(&k, type, i);
+        sprintf(payload, "%d", i);
+        if (insertRecord(idx, NULL, &k, payload) != SUCCESS ||
+            (i % step == 0 && insertRecord(few_idx, NULL, &k, payload) != SUCCESS)) {
+            printf("could not insert key %d into the merge indices\n", i);
+            return -1;
+        }
+    }
+    for (i = 0; i < keys; i++) {
+        if (i % step == 0) {
+            continue;
+        }
+        memset(&record, 0, sizeof(Record));
+        set_key(&record.key, type, i);
+        if (deleteRecord(idx, NULL, &record) != SUCCESS) {
+            printf("could not delete key %d from the merge index\n", i);
+            return -1;
+        }
+    }
+
+    if (compactIndex(name) != SUCCESS || compactIndex(few_name) != SUCCESS ||
+        indexStats(name, &merged) != SUCCESS || indexStats(few_name, &few) != SUCCESS) {
+        printf("could not compact the merge indices\n");
+        return -1;
+    }
+    if (merged.keys != few.keys || merged.used > few.used + few.used / 8 ||
+        merged.objects > few.objects + few.objects / 8) {
+        printf("merged index uses %llu bytes in %llu objects for %llu keys, not about %llu in %llu\n",
+               (unsigned long long)merged.used, (unsigned long long)merged.objects,
+               (unsigned long long)merged.keys, (unsigned long long)few.used,
+               (unsigned long long)few.objects);
+        return -1;
+    }
+    if (scan_index(idx, seen, keys) != (keys + step - 1) / step) {
+        printf("merged index has the wrong number of records\n");
+        return -1;
+    }
+    for (i = 0; i < keys; i++) {
+        if (seen[i] != (i % step == 0)) {
+            printf("merged index has key %d %d times\n", i, seen[i]);
+            return -1;
+        }
+    }
+    closeIndex(idx);
+    closeIndex(few_idx);
+    return 0;
+}
+
+/*
+ Loads an index with keys keys, then deletes all but keep of them: the merged trie nodes and the
+ containers they drop must give their blocks back, without a compaction. The records left keep
+ the blocks they sit in, so not all of them go.
+ */
+static int test_merge_reserved(KeyType type, char *name, int keys, int keep)
+{
+    IndexStats full, merged;
+    IdxState *idx;
+    Record record;
+    Key k;
+    char payload[16];
+    int i, step = keys / keep;
+
+    if (create(type, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create %s\n", name);
+        return -1;
+    }
+    for (i = 0; i < keys; i++) {
+        set_key(&k, type, i);
+        sprintf(payload, "%d", i);
+        if (insertRecord(idx, NULL, &k, payload) != SUCCESS) {
+            printf("could not insert key %d into %s\n", i, name);
+            return -1;
+        }
+    }
+    if (indexStats(name, &full) != SUCCESS) {
+        return -1;
+    }
+    for (i = 0; i < keys; i++) {
+        if (i % step == 0) {
+            continue;
+        }
+        memset(&record, 0, sizeof(Record));
+        set_key(&record.key, type, i);
+        if (deleteRecord(idx, NULL, &record) != SUCCESS) {
+            printf("could not delete key %d from %s\n", i, name);
+            return -1;
+        }
+    }
+    if (indexStats(name, &merged) != SUCCESS) {
+        return -1;
+    }
+    if (merged.keys != (uint64_t)keep || merged.reserved > full.reserved - full.reserved / 5) {
+        printf("%s keeps %llu of %llu bytes reserved for %llu keys\n", name,
+               (unsigned long long)merged.reserved, (unsigned long long)full.reserved,
+               (unsigned long long)merged.keys);
+        return -1;
+    }
+    closeIndex(idx);
+    return 0;
+}
+
+/*
+ Gets key in a transaction, expecting want (NULL for KEY_NOTFOUND), then getNext must return
+ next (NULL for DB_END).
+ */
+static int get_then_next(IdxState *idx, TxnState *txn, const char *key, const char *want,
+                         const char *next)
+{
+    Record record;
+    int errCode;
+
+    memset(&record, 0, sizeof(Record));
+    record.key.type = VARCHAR;
+    strcpy(record.key.keyval.charkey, key);
+    errCode = get(idx, txn, &record);
+    if (errCode != (want == NULL ? KEY_NOTFOUND : SUCCESS) ||
+        (want != NULL && strcmp(record.payload, want) != 0)) {
+        printf("get(%s) returned %d (payload %s)\n", key, errCode, record.payload);
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    errCode = getNext(idx, txn, &record);
+    if (errCode != (next == NULL ? DB_END : SUCCESS) ||
+        (next != NULL && strcmp(record.key.keyval.charkey, next) != 0)) {
+        printf("getNext after %s returned %d (key %s), not %s\n", key, errCode,
+               record.key.keyval.charkey, next == NULL ? "DB_END" : next);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ Deletes the VARCHAR keys prefix000 to prefix<last> but skip.
+ */
+static int delete_group(IdxState *idx, TxnState *txn, const char *prefix, int last, int skip)
+{
+    Record record;
+    int i;
+
+    for (i = 0; i <= last; i++) {
+        if (i == skip) {
+            continue;
+        }
+        memset(&record, 0, sizeof(Record));
+        record.key.type = VARCHAR;
+        sprintf(record.key.keyval.charkey, "%s%03d", prefix, i);
+        if (deleteRecord(idx, txn, &record) != SUCCESS) {
+            printf("could not delete %s\n", record.key.keyval.charkey);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ The key "m" ends at the trie node its 100 longer keys burst into; deleting them down to one
+ merges the node into a container which must keep "m" and order it first. A transaction whose
+ cursor is in the group before crosses the merged node to the group after, and an aborted one
+ restores the records it deleted into a merged node.
+ */
+static int test_merge_varchar(void)
+{
+    char *name = "merge_term";
+    IdxState *idx;
+    TxnState *txn;
+    Key k;
+    int i, n, errCode;
+    Record record;
+    const char *groups[3] = {"a", "m", "z"};
+
+    if (create(VARCHAR, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create the merge index\n");
+        return -1;
+    }
+    k.type = VARCHAR;
+    for (n = 0; n < 3; n++) {
+        strcpy(k.keyval.charkey, groups[n]);
+        if (insertRecord(idx, NULL, &k, groups[n]) != SUCCESS) {
+            return -1;
+        }
+        for (i = 0; i < 100; i++) {
+            sprintf(k.keyval.charkey, "%s%03d", groups[n], i);
+            if (insertRecord(idx, NULL, &k, k.keyval.charkey) != SUCCESS) {
+                printf("could not insert %s into the merge index\n", k.keyval.charkey);
+                return -1;
+            }
+        }
+    }
+
+    //a cursor on the last key of a crosses the node of m, merged under it.
+    if (beginTransaction(&txn) != SUCCESS ||
+        get_then_next(idx, txn, "a099", "a099", "m") != 0 ||
+        get_then_next(idx, txn, "a099", "a099", "m") != 0) {
+        return -1;
+    }
+    if (delete_group(idx, txn, "m", 99, 50) != 0) {
+        return -1;
+    }
+    if (get_then_next(idx, txn, "a099", "a099", "m") != 0 ||
+        get_then_next(idx, txn, "m", "m", "m050") != 0 ||
+        get_then_next(idx, txn, "m050", "m050", "z") != 0 ||
+        get_then_next(idx, txn, "m0", NULL, "m050") != 0 ||
+        get_then_next(idx, txn, "m051", NULL, "z") != 0) {
+        printf("failed to cross the merged node in the deleting transaction\n");
+        return -1;
+    }
+    //the records come back into the merged node.
+    if (abortTransaction(txn) != SUCCESS) {
+        printf("could not abort the merge transaction\n");
+        return -1;
+    }
+    for (i = 0; i < 100; i++) {
+        memset(&record, 0, sizeof(Record));
+        record.key.type = VARCHAR;
+        sprintf(record.key.keyval.charkey, "m%03d", i);
+        if (get(idx, NULL, &record) != SUCCESS || strcmp(record.payload, record.key.keyval.charkey) != 0) {
+            printf("abort did not restore %s into the merged node\n", record.key.keyval.charkey);
+            return -1;
+        }
+    }
+    if (beginTransaction(&txn) != SUCCESS ||
+        get_then_next(idx, txn, "m", "m", "m000") != 0 ||
+        get_then_next(idx, txn, "m099", "m099", "z") != 0 ||
+        commitTransaction(txn) != SUCCESS) {
+        printf("aborted merge left the wrong order\n");
+        return -1;
+    }
+
+    //merge for good: "m" sits on the node's term, then is all that is left of it.
+    if (delete_group(idx, NULL, "m", 99, 50) != 0) {
+        return -1;
+    }
+    if (beginTransaction(&txn) != SUCCESS ||
+        get_then_next(idx, txn, "a099", "a099", "m") != 0 ||
+        get_then_next(idx, txn, "m", "m", "m050") != 0 ||
+        get_then_next(idx, txn, "m050", "m050", "z") != 0 ||
+        commitTransaction(txn) != SUCCESS) {
+        printf("failed to keep the term of the merged node\n");
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    record.key.type = VARCHAR;
+    strcpy(record.key.keyval.charkey, "m050");
+    if (deleteRecord(idx, NULL, &record) != SUCCESS || deleteRecord(idx, NULL, &record) != KEY_NOTFOUND) {
+        printf("could not delete m050 once\n");
+        return -1;
+    }
+    if (beginTransaction(&txn) != SUCCESS ||
+        get_then_next(idx, txn, "m", "m", "z") != 0 ||
+        get_then_next(idx, txn, "a099", "a099", "m") != 0 ||
+        commitTransaction(txn) != SUCCESS) {
+        printf("failed to keep the term alone\n");
+        return -1;
+    }
+    memset(&record, 0, sizeof(Record));
+    record.key.type = VARCHAR;
+    strcpy(record.key.keyval.charkey, "m");
+    if ((errCode = deleteRecord(idx, NULL, &record)) != SUCCESS) {
+        printf("could not delete the term -- %d\n", errCode);
+        return -1;
+    }
+    if (beginTransaction(&txn) != SUCCESS ||
+        get_then_next(idx, txn, "a099", "a099", "z") != 0 ||
+        get_then_next(idx, txn, "m", NULL, "z") != 0 ||
+        commitTransaction(txn) != SUCCESS) {
+        printf("failed to drop the merged node\n");
+        return -1;
+    }
+    closeIndex(idx);
+    return 0;
+}
+
+#define COMPACT_KEYS 65536
+#define COMPACT_WRITES 1024
+
+int COMPACT_DONE = 0;
+
+/*
+ Inserts the keys first, first + 2, ... of COMPACT_WRITES out of any transaction.
+ */
+static void *compact_writer_func(void *arg)
+{
+    ThreadArg *c = (ThreadArg*)arg;
+    IdxState *idx;
+    Key k;
+    char payload[16];
+    int i;
+
+    c->result = -1;
+    if (openIndex(c->name, &idx) != SUCCESS) {
+        printf("compaction writer could not open the index\n");
+        return NULL;
+    }
+    for (i = 0; i < COMPACT_WRITES; i++) {
+        set_key(&k, c->type, c->first + 2 * i);
+        sprintf(payload, "%d", c->first + 2 * i);
+        if (insertRecord(idx, NULL, &k, payload) != SUCCESS) {
+            printf("compaction writer could not insert key %d\n", c->first + 2 * i);
+            return NULL;
+        }
+    }
+    closeIndex(idx);
+    c->result = 0;
+    return NULL;
+}
+
+/*
+ Scans the index in transactions until the writers are done: every scan is in order and holds
+ every key left from before the deletes.
+ */
+static void *compact_scanner_func(void *arg)
+{
+    ThreadArg *c = (ThreadArg*)arg;
+    static int seen[COMPACT_KEYS + 2 * COMPACT_WRITES];
+    IdxState *idx;
+    int i;
+
+    c->result = -1;
+    if (openIndex(c->name, &idx) != SUCCESS) {
+        printf("compaction scanner could not open the index\n");
+        return NULL;
+    }
+    while (!__atomic_load_n(&COMPACT_DONE, __ATOMIC_ACQUIRE)) {
+        if (scan_index(idx, seen, COMPACT_KEYS + 2 * COMPACT_WRITES) < 0) {
+            return NULL;
+        }
+        for (i = 0; i < COMPACT_KEYS; i += 8) {
+            if (seen[i] != 1 + (i % 64 == 0)) {
+                printf("compaction scanner saw key %d %d times\n", i, seen[i]);
+                return NULL;
+            }
+        }
+    }
+    closeIndex(idx);
+    c->result = 0;
+    return NULL;
+}
+
+/*
+ Deletes most keys of an index and compacts it, which must give memory back, then compacts it
+ again while two writers insert and a scanner scans it; the index must hold the keys left and
+ all the keys written, in order.
+ */
+static int test_compaction(KeyType type, char *name)
+{
+    static int seen[COMPACT_KEYS + 2 * COMPACT_WRITES];
+    ThreadArg writers[2], scanner;
+    pthread_t writer_threads[2], scanner_thread;
+    IndexStats before, after;
+    IdxState *idx;
+    Record record;
+    Key k;
+    char payload[16];
+    int i, n = COMPACT_KEYS + 2 * COMPACT_WRITES;
+
+    if (create(type, name) != SUCCESS || openIndex(name, &idx) != SUCCESS) {
+        printf("could not create the compaction index\n");
+        return -1;
+    }
+    //every 64th key has two payloads.
+    for (i = 0; i < COMPACT_KEYS; i++) {
+        set_key(&k, type, i);
+        sprintf(payload, "%d", i);
+        if (insertRecord(idx, NULL, &k, payload) != SUCCESS) {
+            printf("could not insert key %d into the compaction index\n", i);
+            return -1;
+        }
+        sprintf(payload, "%d", i + n);
+        if (i % 64 == 0 && insertRecord(idx, NULL, &k, payload) != SUCCESS) {
+            printf("could not insert a second payload of key %d\n", i);
+            return -1;
+        }
+    }
+    //keep one key of 8.
+    for (i = 0; i < COMPACT_KEYS; i++) {
+        if (i % 8 == 0) {
+            continue;
+        }
+        memset(&record, 0, sizeof(Record));
+        set_key(&record.key, type, i);
+        if (deleteRecord(idx, NULL, &record) != SUCCESS) {
+            printf("could not delete key %d from the compaction index\n", i);
+            return -1;
+        }
+    }
+
+    if (indexStats(name, &before) != SUCCESS || compactIndex(name) != SUCCESS ||
+        indexStats(name, &after) != SUCCESS) {
+        printf("could not compact the index\n");
+        return -1;
+    }
+    //the old containers empty whole blocks, the records left keep theirs.
+    if (after.used >= before.used || after.reserved >= before.reserved ||
+        after.keys != before.keys) {
+        printf("compaction left %llu bytes of %llu used, %llu of %llu reserved\n",
+               (unsigned long long)after.used, (unsigned long long)before.used,
+               (unsigned long long)after.reserved, (unsigned long long)before.reserved);
+        return -1;
+    }
+
+    COMPACT_DONE = 0;
+    for (i = 0; i < 2; i++) {
+        writers[i].name = name;
+        writers[i].type = type;
+        writers[i].first = COMPACT_KEYS + i;
+        if (pthread_create(&writer_threads[i], NULL, compact_writer_func, &writers[i]) != 0) {
+            return -1;
+        }
+    }
+    scanner.name = name;
+    scanner.type = type;
+    if (pthread_create(&scanner_thread, NULL, compact_scanner_func, &scanner) != 0) {
+        return -1;
+    }
+    //the writers also fill the containers compaction trims.
+    for (i = 0; i < 8; i++) {
+        if (compactIndex(name) != SUCCESS) {
+            printf("could not compact the index under the writers\n");
+            return -1;
+        }
+    }
+    pthread_join(writer_threads[0], NULL);
+    pthread_join(writer_threads[1], NULL);
+    __atomic_store_n(&COMPACT_DONE, 1, __ATOMIC_RELEASE);
+    pthread_join(scanner_thread, NULL);
+    if (writers[0].result != 0 || writers[1].result != 0 || scanner.result != 0) {
+        return -1;
+    }
+    if (compactIndex(name) != SUCCESS) {
+        printf("could not compact the index after the writers\n");
+        return -1;
+    }
+
+    //the keys left, once each but every 64th twice, and all the keys written.
+    if (scan_index(idx, seen, n) != COMPACT_KEYS / 8 + COMPACT_KEYS / 64 + 2 * COMPACT_WRITES) {
+        printf("compacted index has the wrong number of records\n");
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        int want = (i >= COMPACT_KEYS) ? 1 : ((i % 8 == 0) + (i % 64 == 0));
+        if (seen[i] != want) {
+            printf("compacted index has key %d %d times, not %d\n", i, seen[i], want);
+            return -1;
+        }
+    }
+    for (i = 0; i < COMPACT_KEYS; i += 64) {
+        memset(&record, 0, sizeof(Record));
+        set_key(&record.key, type, i);
+        if (get(idx, NULL, &record) != SUCCESS || atoi(record.payload) % n != i) {
+            printf("could not get key %d from the compacted index\n", i);
+            return -1;
+        }
+    }
+    closeIndex(idx);
+    return 0;
+}
+
 #ifndef RUNNING_SPEED_TEST
 int main(void)
 {
@@ -962,6 +3027,103 @@ multi_tbl_txn:
     
     printf("successfully passed main function tests!\n");
     
+    if (test_deadlock(2, DEADLOCK_OLDER_WAITS) != 0 ||
+        test_deadlock(2, DEADLOCK_YOUNGER_WAITS) != 0 ||
+        test_deadlock(3, DEADLOCK_RING) != 0) {
+        printf("failed deadlock tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed deadlock tests!\n");
+    
+    if (test_u_lock("u_lock_index") != 0) {
+        printf("failed U lock tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed U lock tests!\n");
+    
+    if (test_handle_reuse("handle_reuse_index") != 0 || test_handle_slots("handle_slot") != 0 ||
+        test_handle_in_txn("handle_txn_index", "handle_txn_other") != 0) {
+        printf("failed handle cache tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed handle cache tests!\n");
+    
+    if (test_index_stats(SHORT, "stats_short") != 0 ||
+        test_index_stats(INT, "stats_int") != 0 ||
+        test_index_stats(VARCHAR, "stats_varchar") != 0) {
+        printf("failed index stats tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed index stats tests!\n");
+    
+    if (test_bulk_load(SHORT, "bulk_short") != 0 ||
+        test_bulk_load(INT, "bulk_int") != 0 ||
+        test_bulk_load(VARCHAR, "bulk_varchar") != 0) {
+        printf("failed bulk load tests\n");
+        return EXIT_FAILURE;
+    }
+    if (test_parallel_bulk_load(SHORT, "parallel_short") != 0 ||
+        test_parallel_bulk_load(INT, "parallel_int") != 0 ||
+        test_parallel_bulk_load(VARCHAR, "parallel_varchar") != 0) {
+        printf("failed parallel bulk load tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed bulk load tests!\n");
+    
+    if (test_count_less(SHORT, "count_less_short") != 0 ||
+        test_count_less(INT, "count_less_int") != 0) {
+        printf("failed container search tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed container search tests!\n");
+    
+    if (test_next_after_miss(SHORT, "miss_short") != 0 ||
+        test_next_after_miss(INT, "miss_int") != 0 ||
+        test_next_after_miss(VARCHAR, "miss_varchar") != 0) {
+        printf("failed getNext after a miss tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed getNext after a miss tests!\n");
+    
+    if (test_front_coding("front_coded_index") != 0) {
+        printf("failed front coding tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed front coding tests!\n");
+    
+    if (test_record_set(SHORT, "record_set_short") != 0 ||
+        test_record_set(INT, "record_set_int") != 0 ||
+        test_record_set(VARCHAR, "record_set_varchar") != 0) {
+        printf("failed record set tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed record set tests!\n");
+    
+    if (test_share_payloads(INT, "share_int") != 0 ||
+        test_share_payloads(VARCHAR, "share_varchar") != 0) {
+        printf("failed shared payload tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed shared payload tests!\n");
+    
+    if (test_merge_burst(INT, "merge_int", "merge_int_few", 4000, 40) != 0 ||
+        test_merge_reserved(INT, "merge_int_reserved", 200000, 2000) != 0 ||
+        test_merge_reserved(VARCHAR, "merge_varchar_reserved", 100000, 1000) != 0 ||
+        test_merge_burst(VARCHAR, "merge_varchar", "merge_varchar_few", 400, 2) != 0 ||
+        test_merge_varchar() != 0) {
+        printf("failed merge tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed merge tests!\n");
+    
+    if (test_compaction(SHORT, "compact_short") != 0 ||
+        test_compaction(INT, "compact_int") != 0 ||
+        test_compaction(VARCHAR, "compact_varchar") != 0) {
+        printf("failed compaction tests\n");
+        return EXIT_FAILURE;
+    }
+    printf("successfully passed compaction tests!\n");
+    
     int i;
     for (i = 0; i < 5; i++) {
         wait_thread();